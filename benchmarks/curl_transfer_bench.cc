@@ -0,0 +1,168 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <cctype>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <network/curl.hh>
+#include <network/curl_multi.hh>
+
+using namespace shimiyuu::network;
+
+/**
+ * HTTP/1.1 server on the loopback interface with persistent connections, answering every request with the same
+ * JSON lines, deflated when the request accepts it
+ */
+class LoopbackServer {
+
+public:
+	LoopbackServer() {
+		for (int i = 0; m_body.size() < 64 * 1024; ++i)
+			m_body += "{\"id\": " + std::to_string(i) + ", \"name\": \"item " + std::to_string(i)
+				+ "\", \"tags\": [\"loopback\", \"benchmark\"]}\n";
+		uLongf size = compressBound(m_body.size());
+		m_deflated.resize(size);
+		if (compress2(reinterpret_cast<Bytef*>(m_deflated.data()), &size, reinterpret_cast<const Bytef*>(m_body.data()),
+				m_body.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+			throw std::runtime_error("cannot deflate the response body");
+		m_deflated.resize(size);
+
+		m_fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr { };
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(addr);
+		if (bind(m_fd, reinterpret_cast<sockaddr*>(&addr), length) || listen(m_fd, 128)
+				|| getsockname(m_fd, reinterpret_cast<sockaddr*>(&addr), &length))
+			throw std::runtime_error("cannot listen on the loopback interface");
+		m_port = ntohs(addr.sin_port);
+		m_thread = std::thread(&LoopbackServer::run, this);
+	}
+
+	~LoopbackServer() {
+		shutdown(m_fd, SHUT_RDWR);
+		close(m_fd);
+		m_thread.join();
+		{
+			std::lock_guard lock(m_mutex);
+			for (const int client : m_clients)
+				shutdown(client, SHUT_RDWR);
+		}
+		for (auto& connection : m_connections)
+			connection.join();
+	}
+
+	std::string url() const {
+		return "http://127.0.0.1:" + std::to_string(m_port) + "/items";
+	}
+
+private:
+	void run() {
+		for (int client; (client = accept(m_fd, nullptr, nullptr)) >= 0; ) {
+			std::lock_guard lock(m_mutex);
+			m_clients.push_back(client);
+			m_connections.emplace_back(&LoopbackServer::serve, this, client);
+		}
+	}
+
+	void serve(int client) {
+		std::string received;
+		char buffer[4096];
+		for (ssize_t n; (n = read(client, buffer, sizeof(buffer))) > 0; ) {
+			received.append(buffer, n);
+			for (std::size_t end; (end = received.find("\r\n\r\n")) != std::string::npos; ) {
+				std::string request = received.substr(0, end);
+				received.erase(0, end + 4);
+				std::transform(request.begin(), request.end(), request.begin(),
+					[](unsigned char c) { return std::tolower(c); });
+				const bool deflate = request.find("\r\naccept-encoding:") != std::string::npos
+					&& request.find("deflate", request.find("\r\naccept-encoding:")) != std::string::npos;
+				const std::string& body = deflate ? m_deflated : m_body;
+				const std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/jsonl\r\n"
+					+ std::string(deflate ? "Content-Encoding: deflate\r\n" : "")
+					+ "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+				if (!write_all(client, response)) break;
+			}
+		}
+		std::lock_guard lock(m_mutex);
+		m_clients.erase(std::find(m_clients.begin(), m_clients.end(), client));
+		close(client);
+	}
+
+	static bool write_all(int fd, const std::string& data) {
+		for (std::size_t sent = 0; sent < data.size(); ) {
+			const ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+			if (n <= 0) return false;
+			sent += n;
+		}
+		return true;
+	}
+
+	std::string m_body, m_deflated;
+	int m_fd;
+	unsigned short m_port;
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::vector<int> m_clients;
+	std::vector<std::thread> m_connections;
+};
+
+/**
+ * Compares the transfer options of Curl:
+ * bytes on the wire with and without set_compression, and the request rate of a CurlMulti
+ * over HTTP/1.1 and over multiplexed HTTP/2 (use an https:// URL, or h2c_url for an h2c server).
+ *
+ * Without a url, or with "loopback", it runs unattended against an in-process HTTP/1.1 server on the loopback
+ * interface, so the numbers repeat from run to run; HTTP/2 is then left out.
+ *
+ * usage: curl_transfer_bench [url|loopback] [requests] [h2c_url]
+ */
+int main(int argc, char* argv[]) {
+	std::string url = argc > 1 ? argv[1] : "loopback";
+	const std::size_t requests = argc > 2 ? std::stoul(argv[2]) : 200;
+	const std::string h2c_url = argc > 3 ? argv[3] : "";
+
+	std::unique_ptr<LoopbackServer> server;
+	if (url == "loopback") {
+		server = std::make_unique<LoopbackServer>();
+		url = server->url();
+	}
+
+	for (const bool compression : { false, true }) {
+		Curl curl;
+		curl.set_compression(compression);
+		const std::string body = curl.get_string(url);
+		std::cout << "compression " << (compression ? "on " : "off") << ": " << body.size() << " bytes decoded, "
+			<< curl.last_metrics().bytes_received << " bytes received" << std::endl;
+	}
+
+	const auto rate = [&](const std::string& name, const std::string& target, bool http2, bool prior_knowledge) {
+		Curl prototype;
+		prototype.set_http2(http2, prior_knowledge);
+		CurlMulti multi(prototype, 64, 4);
+		std::size_t failed = 0;
+		for (std::size_t i = 0; i < requests; ++i)
+			multi.get_string(target, [&](CurlMulti::Response response) { failed += !response.ok(); });
+		const auto start = std::chrono::steady_clock::now();
+		multi.perform();
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << name << ": " << requests << " requests in " << elapsed.count() << " s, "
+			<< requests / elapsed.count() << " requests/s, " << failed << " failed" << std::endl;
+	};
+	rate("HTTP/1.1", url, false, false);
+	if (!server) rate("HTTP/2  ", url, true, false);
+	if (!h2c_url.empty()) rate("h2c     ", h2c_url, true, true);
+	return EXIT_SUCCESS;
+}
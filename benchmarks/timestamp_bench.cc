@@ -0,0 +1,35 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+
+#include <helper.hh>
+
+using namespace shimiyuu;
+
+/**
+ * Compares the cost per call of the timestamp formatters used by SYLogger.
+ *
+ * usage: timestamp_bench [iterations]
+ */
+int main(int argc, char* argv[]) {
+	const std::size_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+	std::size_t checksum = 0; // keeps the calls from being optimized away
+	const auto measure = [&](const std::string& name, const std::function<std::size_t()>& format) {
+		const auto start = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < iterations; ++i)
+			checksum += format();
+		const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << name << ": " << elapsed.count() / iterations << " ns per call" << std::endl;
+	};
+
+	measure("timestamp_uncached()", [] { return helper::timestamp_uncached().size(); });
+	measure("timestamp()         ", [] { return helper::timestamp().size(); });
+	measure("timestamp(buffer)   ", [] {
+		char buffer[helper::timestamp_length];
+		return helper::timestamp(buffer)[11] - '0';
+	});
+	return checksum ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,70 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include <SQLite3DB.hh>
+
+#ifndef INCLUDE_SHIMIYUU_DELIMITEDIMPORTER_HH_
+#define INCLUDE_SHIMIYUU_DELIMITEDIMPORTER_HH_
+
+namespace shimiyuu {
+
+/**
+ * Bulk import of CSV / TSV files into a SQLite3DB table.
+ *
+ * The file is memory-mapped and tokenized in place: fields are views into the mapping
+ * (only quoted fields containing escaped quotes are copied). A parser thread produces batches of rows
+ * while the calling thread inserts the previous batch. The whole file is imported in one transaction
+ * (or within the current one if a transaction is active), so a bad record leaves the table unchanged.
+ * Blank lines are skipped, except in single-column files where they hold an empty value.
+ */
+class DelimitedImporter {
+
+public:
+	struct Options {
+		char delimiter = ',';
+		char quote = '"';
+		/** the first record holds column names */
+		bool header = true;
+		/** target columns, in file order, as SQL; taken from the header (quoted as identifiers) if empty */
+		std::vector<std::string> columns;
+		/** rows handed from the parser thread to the inserting thread at once */
+		std::size_t batch_rows = 50000;
+		/** rows per multi-row INSERT, see SQLite3DB::insert(.. rows_per_statement) */
+		std::size_t rows_per_statement = 64;
+	};
+
+	struct Statistics {
+		std::uint64_t bytes = 0;
+		std::uint64_t rows = 0;
+		std::chrono::duration<double> elapsed { 0 };
+
+		double mb_per_second() const;
+		double rows_per_second() const;
+	};
+
+	DelimitedImporter(const std::string& file);
+	~DelimitedImporter();
+
+	DelimitedImporter(const DelimitedImporter&) = delete;
+	DelimitedImporter& operator=(const DelimitedImporter&) = delete;
+
+	/**
+	 * Insert all records of the file into table_name.
+	 * @throw	runtime_error if a record does not have one field per column
+	 */
+	Statistics import(SQLite3DB& db, std::string_view table_name, const Options& options);
+
+	static Options tsv();
+
+private:
+	const std::string m_file;
+	const char* m_data = nullptr;
+	std::size_t m_size = 0;
+};
+
+}
+
+#endif
@@ -3,6 +3,18 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
+#include <span>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <functional>
+#include <array>
+#include <map>
+#include <mutex>
+#include <chrono>
 
 #include <helper.hh>
 
@@ -18,6 +30,8 @@ namespace shimiyuu {
 extern SYLogger<int> sqlite3db_logger;
 
 class SQLite3DB {
+	friend class SQLite3DBWriteQueue;
+	friend class DelimitedImporter;
 
 public:
 
@@ -27,6 +41,62 @@ public:
 	enum class KeyType {
 		NONE, PRIMARY, FOREIGN
 	};
+	/** DEFAULT leaves the setting of the database file / SQLite build untouched */
+	enum class JournalMode {
+		DEFAULT, TRUNCATE, PERSIST, MEMORY, WAL, OFF
+	};
+	enum class Synchronous {
+		DEFAULT, OFF, NORMAL, FULL, EXTRA
+	};
+	enum class TempStore {
+		DEFAULT, FILE, MEMORY
+	};
+
+	/**
+	 * Connection settings applied when opening a database.
+	 * Unset values keep SQLite's defaults.
+	 */
+	struct Options {
+		bool read_only = false;
+		JournalMode journal_mode = JournalMode::DEFAULT;
+		Synchronous synchronous = Synchronous::DEFAULT;
+		std::optional<std::int64_t> cache_size_kib;
+		std::optional<std::int64_t> mmap_size;
+		TempStore temp_store = TempStore::DEFAULT;
+		std::optional<int> busy_timeout_ms;
+		/** prepared statements kept for reuse, the least recently used are finalized beyond that */
+		std::size_t statement_cache_size = 256;
+
+		/** WAL, every commit synced to disk */
+		static Options durable();
+		/** WAL without syncing, large page cache, temporaries in memory: a crash may lose recent commits */
+		static Options bulk_load();
+		/** WAL, synced at checkpoints, large page cache and memory-mapped reads */
+		static Options read_mostly();
+	};
+
+	/** the settings in effect on a connection, as reported by SQLite */
+	struct Settings {
+		bool read_only;
+		std::string journal_mode;
+		Synchronous synchronous;
+		std::int64_t cache_size; // pages if positive, KiB if negative
+		std::int64_t mmap_size;
+		TempStore temp_store;
+		bool foreign_keys;
+
+		std::string to_string() const;
+	};
+
+	/** execution statistics of one normalized statement, see profile(..) */
+	struct StatementStatistics {
+		std::uint64_t calls = 0;
+		std::uint64_t rows_changed = 0;
+		std::chrono::nanoseconds total_time { 0 };
+		std::chrono::nanoseconds max_time { 0 };
+		/** latency_histogram[i] counts calls that took less than 2^i microseconds, the last bucket all longer calls */
+		std::array<std::uint64_t, 24> latency_histogram { };
+	};
 
 	class Column {
 		friend class SQLite3DB;
@@ -73,29 +143,247 @@ public:
 		}
 	};
 
+	/**
+	 * A secondary index on a table.
+	 * covering_columns are appended after the key columns, so queries reading only indexed columns
+	 * are answered from the index alone. A where clause makes a partial index of the matching rows.
+	 */
+	class Index {
+		friend class SQLite3DB;
+
+		const std::string name;
+		const std::string table_name;
+		const std::vector<std::string> columns;
+		const bool unique;
+		const std::string where;
+		const std::vector<std::string> covering_columns;
+
+		std::string to_sql() const;
+
+	public:
+		Index(const std::string& name, const std::string& table_name, const std::vector<std::string>& columns,
+				bool unique = false, const std::string& where = "",
+				const std::vector<std::string>& covering_columns = { });
+	};
+
+	/** one line of EXPLAIN QUERY PLAN */
+	struct QueryPlanStep {
+		int id;
+		int parent;
+		std::string detail;
+		bool full_scan; // the step reads a whole table without an index (subqueries and CTEs do not count)
+	};
+
+	struct BackupOptions {
+		/** pages copied per step, negative to copy everything in one step */
+		int pages_per_step = 256;
+		/** pause between steps, letting writers on other connections take the database lock */
+		std::chrono::milliseconds pause { 10 };
+		/** called after each step with the number of remaining and total pages, returning false aborts the backup */
+		std::function<bool(int remaining, int total)> progress;
+	};
+
 private:
+	struct StatementHash {
+		using is_transparent = void; // look up string_views without building a std::string
+		std::size_t operator()(std::string_view sql) const;
+	};
+
+	struct Profile {
+		std::mutex mtx;
+		std::unordered_map<std::string, StatementStatistics, StatementHash, std::equal_to<> > statistics;
+		std::chrono::nanoseconds slow_threshold;
+		// SQLite only reports elapsed time in whole milliseconds: time running statements ourselves
+		std::unordered_map<sqlite3_stmt*, std::chrono::steady_clock::time_point> running; // only used by the connection's thread
+	};
+	std::unique_ptr<Profile> m_profile; // declared before m_db: the trace callback uses it until the connection is closed
+
+	static int trace(unsigned type, void* profile, void* stmt, void*);
+
 	struct sqlite3Deleter {
 		void operator()(sqlite3* db) const;
 	};
 	std::unique_ptr<sqlite3, sqlite3Deleter> m_db;
 
+	struct sqlite3_stmtDeleter {
+		void operator()(sqlite3_stmt* stmt) const;
+	};
+	struct CachedStatement {
+		std::unique_ptr<sqlite3_stmt, sqlite3_stmtDeleter> stmt;
+		std::uint64_t last_use = 0; // of m_statement_uses
+
+		sqlite3_stmt* get() const {
+			return stmt.get();
+		}
+	};
+	using StatementCache = std::unordered_map<std::string, CachedStatement, StatementHash, std::equal_to<> >;
+	StatementCache m_statements; // declared after m_db: all statements must be finalized before closing
+	std::size_t m_statement_cache_size;
+	std::uint64_t m_statement_uses = 0;
+
+	bool m_verify_query_plans = false;
+
+	/**
+	 * A prepared statement checked out of the statement cache of a SQLite3DB.
+	 * On destruction, the statement is reset and handed back to the cache, so executing
+	 * the same SQL again only costs reset + bind + step instead of parsing and planning.
+	 * The cache holds at most Options::statement_cache_size statements, evicting the least recently used.
+	 */
+	class Statement {
+		SQLite3DB& m_db;
+		StatementCache::node_type m_node;
+		const bool m_cached;
+
+	public:
+		/** @param cached	false to prepare sql afresh and finalize it on destruction, for one-off statements */
+		Statement(SQLite3DB& db, std::string_view sql, bool cached = true);
+		~Statement();
+
+		Statement(const Statement&) = delete;
+		Statement& operator=(const Statement&) = delete;
+
+		/**
+		 * Bind value to the 1-based parameter index.
+		 * value is not copied and must stay valid until the statement is stepped.
+		 */
+		void bind(int index, std::string_view value);
+		void bind(int index, std::int64_t value);
+		void bind(int index, double value);
+		void bind_null(int index);
+
+		/** bind an integral, floating point, text or std::optional (nullopt as NULL) value */
+		template<typename T>
+		void bind_value(int index, const T& value) {
+			if constexpr (requires { value.has_value(); }) {
+				if (value) bind_value(index, *value);
+				else bind_null(index);
+			} else if constexpr (std::is_integral_v<T>)
+				bind(index, static_cast<std::int64_t>(value));
+			else if constexpr (std::is_floating_point_v<T>)
+				bind(index, static_cast<double>(value));
+			else
+				bind(index, std::string_view(value));
+		}
+
+		/** bind the elements of values to consecutive parameters starting at first_index */
+		template<typename ... T>
+		void bind_tuple(const std::tuple<T ...>& values, int first_index = 1) {
+			std::apply([&](const T& ... value) {
+				int index = first_index;
+				(bind_value(index++, value), ...);
+			}, values);
+		}
+
+		/**
+		 * Evaluate the statement up to the next result row.
+		 * @return	true if a row is available, false when the statement is done
+		 */
+		bool step();
+
+		/** execute the statement to completion and reset it for the next execution */
+		void run();
+
+		sqlite3_stmt* get() const;
+	};
+
+	/**
+	 * BEGIN on construction. Ended by commit(), or else on destruction: rolled back while an exception
+	 * is unwinding, committed otherwise (rolled back and logged if that COMMIT fails).
+	 */
 	class Transaction {
 		SQLite3DB& m_db;
+		const int m_uncaught_exceptions;
+		bool m_open = true;
 
 	public:
 		Transaction(SQLite3DB& db);
 		~Transaction();
+
+		/** @throw	runtime_error if COMMIT fails, the transaction is then rolled back */
+		void commit();
 	};
 
 	static std::string to_sql(DataType data_type);
+	static std::string to_sql(JournalMode journal_mode);
 
 	void exec(const std::string& sql);
 
+	Statement prepare(std::string_view sql);
+
+	static std::string insert_sql(std::string_view table_name, const std::vector<std::string>& columns,
+			std::size_t row_count, const std::string& conflict_clause = "");
+
+	static std::string upsert_clause(const std::vector<std::string>& columns,
+			const std::vector<std::string>& conflict_columns);
+
+	template<typename ValueAt>
+	void insert_rows(std::string_view table_name, const std::vector<std::string>& columns,
+			std::size_t row_count, std::size_t rows_per_statement, ValueAt value_at,
+			const std::string& conflict_clause = "");
+
+	void backup_to(sqlite3* destination, const BackupOptions& options);
+
 	void create_with_constraints(std::string_view table_name, const std::vector<Column>& columns,
 			const std::string& constraint_clauses);
 
 public:
+	/**
+	 * The current result row of a Query. Values are read directly from SQLite's buffers:
+	 * text views are only valid until the query is advanced.
+	 */
+	class Row {
+		sqlite3_stmt* m_stmt;
+
+	public:
+		Row(sqlite3_stmt* stmt);
+
+		int size() const;
+		bool is_null(int column) const;
+		std::string_view text(int column) const;
+		std::int64_t integer(int column) const;
+		double real(int column) const;
+	};
+
+	/**
+	 * A lazily stepped result set: rows are produced one at a time by sqlite3_step,
+	 * so iterating a large result keeps memory use constant.
+	 * The query must not outlive the SQLite3DB it was created from.
+	 */
+	class Query {
+		const std::vector<std::string> m_parameters; // bound without copying, must live as long as the statement
+		Statement m_stmt;
+		bool m_started = false;
+		bool m_has_row = false;
+
+	public:
+		class iterator {
+			Query* m_query;
+
+		public:
+			using iterator_concept = std::input_iterator_tag;
+			using value_type = Row;
+			using difference_type = std::ptrdiff_t;
+
+			iterator(Query* query = nullptr);
+
+			Row operator*() const;
+			iterator& operator++();
+			void operator++(int);
+			bool operator==(std::default_sentinel_t) const;
+		};
+
+		Query(SQLite3DB& db, const std::string& sql, std::vector<std::string> parameters);
+
+		/** advance to the next row @return false if there are no more rows */
+		bool next();
+		Row row() const;
+
+		iterator begin();
+		std::default_sentinel_t end() const;
+	};
+
 	SQLite3DB(const std::string& database_file);
+	SQLite3DB(const std::string& database_file, const Options& options);
 
 	template<typename ... ConstraintCompositeT>
 	std::enable_if_t<std::conjunction_v<
@@ -107,14 +395,135 @@ public:
 				helper::interleave(constraints_sql.begin(), constraints_sql.end(), ""));
 	}
 
+	/** create the table described by a schema::Table type */
+	template<typename TableT>
+	void create() {
+		exec(std::string(TableT::create_sql.view()));
+	}
+
 	[[nodiscard]] Transaction start_transaction();
 
+	/** query the settings currently in effect, e.g. to verify the Options a deployment runs with */
+	Settings settings();
+
+	/**
+	 * Enable or disable collection of StatementStatistics.
+	 * Statements are keyed by their SQL text with literals replaced by ?.
+	 * @param slow_threshold	statements taking longer are written to sqlite3db_logger at level 2
+	 */
+	void profile(bool enable, std::chrono::nanoseconds slow_threshold = std::chrono::nanoseconds::max());
+
+	/** @return a snapshot of the statistics collected since profiling was enabled or last reset */
+	std::map<std::string, StatementStatistics> statistics() const;
+
+	void reset_statistics();
+
 	void insert(std::string_view table_name,
 			const std::vector<std::pair<std::string, std::string> >& column_data);
 
+	/**
+	 * Insert a batch of rows sharing the same columns.
+	 * All rows are inserted within one transaction, none of them if one fails,
+	 * or within the current one if a transaction is active.
+	 * @param rows_per_statement	number of rows packed into a single multi-row VALUES statement,
+	 * 								capped by the number of parameters SQLite allows per statement
+	 */
+	void insert(std::string_view table_name, const std::vector<std::string>& columns,
+			const std::vector<std::vector<std::string> >& rows, std::size_t rows_per_statement = 1);
+
+	/**
+	 * Insert a batch of rows stored in one contiguous buffer, in row-major order
+	 * (values.size() must be a multiple of columns.size()). See insert(.. rows ..).
+	 */
+	void insert(std::string_view table_name, const std::vector<std::string>& columns,
+			std::span<const std::string_view> values, std::size_t rows_per_statement = 1);
+
+	/** insert a row of a schema::Table type, using its compile-time generated INSERT statement */
+	template<typename TableT>
+	void insert(const typename TableT::row_type& row) {
+		Statement stmt = prepare(TableT::insert_sql.view());
+		stmt.bind_tuple(row);
+		stmt.run();
+	}
+
+	/**
+	 * Insert a row or, if it conflicts with an existing row on conflict_columns, update the other columns of that row.
+	 * conflict_columns must be covered by a PRIMARY KEY or UNIQUE constraint.
+	 */
+	void upsert(std::string_view table_name, const std::vector<std::string>& conflict_columns,
+			const std::vector<std::pair<std::string, std::string> >& column_data);
+
+	/** upsert a batch of rows sharing the same columns, see upsert(..) and insert(.. rows ..) */
+	void upsert(std::string_view table_name, const std::vector<std::string>& conflict_columns,
+			const std::vector<std::string>& columns, const std::vector<std::vector<std::string> >& rows,
+			std::size_t rows_per_statement = 1);
+
 	void update(std::string_view table_name,
-			const std::vector<std::pair<std::string, std::string> > new_column_data,
-			const std::vector<std::pair<std::string, std::string> > column_data_conditions);
+			const std::vector<std::pair<std::string, std::string> >& new_column_data,
+			const std::vector<std::pair<std::string, std::string> >& column_data_conditions);
+
+	/**
+	 * Update a batch of rows identified by key_columns, over one prepared statement.
+	 * Each row holds the new values of value_columns followed by the values of key_columns to match.
+	 * All rows are updated within one transaction, none of them if one fails,
+	 * or within the current one if a transaction is active.
+	 */
+	void update(std::string_view table_name, const std::vector<std::string>& value_columns,
+			const std::vector<std::string>& key_columns, const std::vector<std::vector<std::string> >& rows);
+
+	/** delete the rows matching all column_data_conditions */
+	void remove(std::string_view table_name,
+			const std::vector<std::pair<std::string, std::string> >& column_data_conditions);
+
+	/**
+	 * Update the rows of a schema::Table type matching conditions, using its compile-time generated UPDATE statement
+	 * @tparam SetColumns, WhereColumns	schema::Columns of the columns to set and to match
+	 */
+	template<typename TableT, typename SetColumns, typename WhereColumns>
+	void update(const typename TableT::template values_t<SetColumns>& new_values,
+			const typename TableT::template values_t<WhereColumns>& conditions) {
+		Statement stmt = prepare(TableT::template update_sql<SetColumns, WhereColumns>.view());
+		stmt.bind_tuple(new_values);
+		stmt.bind_tuple(conditions, std::tuple_size_v<std::remove_cvref_t<decltype(new_values)> > + 1);
+		stmt.run();
+	}
+
+	/**
+	 * Run a query, binding parameters to its ? placeholders in order.
+	 * Rows are not fetched before the returned Query is iterated.
+	 */
+	Query query(const std::string& sql, std::vector<std::string> parameters = { });
+
+	void create_index(const Index& index);
+
+	/** @return the query plan SQLite chooses for sql, without running it */
+	std::vector<QueryPlanStep> explain(const std::string& sql);
+
+	/** @throw	runtime_error if the plan of sql scans a whole table instead of using an index */
+	void assert_indexed(const std::string& sql);
+
+	/**
+	 * Debug mode: when enabled, every query(..) is checked with assert_indexed first,
+	 * so hot queries that lose their index fail loudly instead of slowing down as tables grow.
+	 */
+	void verify_query_plans(bool enable);
+
+	/**
+	 * Copy the database to destination_file (replacing its content) while it stays in use.
+	 * The copy proceeds in steps of BackupOptions::pages_per_step pages. In WAL mode, it copies the snapshot
+	 * from the start of the backup while writers go on. Otherwise, writes through other connections
+	 * restart the copy with the next step.
+	 * @throw	runtime_error if the backup fails or is aborted through BackupOptions::progress
+	 */
+	void backup(const std::string& destination_file);
+	void backup(const std::string& destination_file, const BackupOptions& options);
+
+	/**
+	 * copy the database into a new in-memory database with the same page size, e.g. as a fast read-only copy
+	 * for analytics. See backup(..)
+	 */
+	SQLite3DB snapshot();
+	SQLite3DB snapshot(const BackupOptions& options);
 
 	static Column default_key(const std::string& name);
 
@@ -0,0 +1,80 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include <SQLite3DB.hh>
+
+#ifndef INCLUDE_SHIMIYUU_SQLITE3DBPOOL_HH_
+#define INCLUDE_SHIMIYUU_SQLITE3DBPOOL_HH_
+
+namespace shimiyuu {
+
+/**
+ * One writer and a fixed number of reader connections to the same database file, opened in WAL mode
+ * so reads proceed concurrently with the writer.
+ *
+ * Connections are handed out to threads as RAII leases. A SQLite3DB is not thread safe on its own:
+ * only use a connection while holding its lease, and only read from reader connections.
+ */
+class SQLite3DBPool {
+
+	std::mutex m_writer_mtx;
+	SQLite3DB m_writer;
+
+	std::vector<std::unique_ptr<SQLite3DB> > m_readers;
+	std::vector<SQLite3DB*> m_idle_readers;
+	std::mutex m_readers_mtx;
+	std::condition_variable m_reader_returned;
+
+	void release(SQLite3DB* reader);
+
+public:
+
+	class WriterLease {
+		std::unique_lock<std::mutex> m_lock;
+		SQLite3DB* m_db;
+
+	public:
+		WriterLease(std::mutex& mtx, SQLite3DB& db);
+
+		SQLite3DB& operator*() const;
+		SQLite3DB* operator->() const;
+	};
+
+	class ReaderLease {
+		SQLite3DBPool* m_pool;
+		SQLite3DB* m_db;
+
+	public:
+		ReaderLease(SQLite3DBPool& pool, SQLite3DB& db);
+		~ReaderLease();
+
+		ReaderLease(ReaderLease&& other) noexcept;
+		ReaderLease& operator=(ReaderLease&&) = delete;
+
+		SQLite3DB& operator*() const;
+		SQLite3DB* operator->() const;
+	};
+
+	/**
+	 * @param reader_count	number of reader connections, at least 1
+	 * @param options	applied to all connections; journal mode is always WAL and readers are opened read only
+	 */
+	SQLite3DBPool(const std::string& database_file, std::size_t reader_count,
+			SQLite3DB::Options options = SQLite3DB::Options::read_mostly());
+
+	SQLite3DBPool(const SQLite3DBPool&) = delete;
+	SQLite3DBPool& operator=(const SQLite3DBPool&) = delete;
+
+	/** lease the writer connection, blocking while another thread holds it */
+	[[nodiscard]] WriterLease writer();
+
+	/** lease an idle reader connection, blocking until one is returned if all are leased */
+	[[nodiscard]] ReaderLease reader();
+};
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+#include <string_view>
+#include <string>
+#include <array>
+#include <tuple>
+#include <optional>
+#include <type_traits>
+#include <algorithm>
+#include <cstddef>
+
+#ifndef INCLUDE_SHIMIYUU_SQLITE3DBSCHEMA_HH_
+#define INCLUDE_SHIMIYUU_SQLITE3DBSCHEMA_HH_
+
+/**
+ * Compile-time table descriptors for SQLite3DB.
+ *
+ * A table is a type listing typed columns; its CREATE, INSERT and UPDATE statements are generated
+ * at compile time and rows are std::tuples of the column types, bound to prepared statements as they are.
+ * Column names are checked at compile time.
+ *
+ *	using Users = schema::Table<"users",
+ *		schema::Column<"id", std::int64_t, schema::PRIMARY_KEY>,
+ *		schema::Column<"name", std::string, schema::UNIQUE>,
+ *		schema::Column<"score", std::optional<double> > >;
+ *
+ *	db.create<Users>();
+ *	db.insert<Users>({ 1, "alice", std::nullopt });
+ *	db.update<Users, schema::Columns<"score">, schema::Columns<"name"> >({ 2.5 }, { "alice" });
+ */
+namespace shimiyuu::schema {
+
+template<std::size_t N>
+struct Name {
+	char chars[N] { };
+
+	constexpr Name(const char (&name)[N]) {
+		std::copy_n(name, N, chars);
+	}
+
+	constexpr std::string_view view() const {
+		return { chars, N - 1 };
+	}
+};
+
+enum Constraint : unsigned {
+	NONE = 0, PRIMARY_KEY = 1, UNIQUE = 2
+};
+
+namespace detail {
+
+template<typename T> struct is_optional : std::false_type { };
+template<typename T> struct is_optional<std::optional<T> > : std::true_type { };
+
+template<typename T> struct value_type {
+	using type = T;
+};
+template<typename T> struct value_type<std::optional<T> > {
+	using type = T;
+};
+
+template<typename T>
+constexpr std::string_view sql_type() {
+	using V = typename value_type<T>::type;
+	if constexpr (std::is_integral_v<V>)
+		return "INTEGER";
+	else if constexpr (std::is_floating_point_v<V>)
+		return "REAL";
+	else {
+		static_assert(std::is_convertible_v<const V&, std::string_view>, "column type must be integral, floating point or text");
+		return "TEXT";
+	}
+}
+
+/** first pass of SQL generation: only measures */
+struct SQLLength {
+	std::size_t size = 0;
+
+	constexpr SQLLength& operator<<(std::string_view sql) {
+		size += sql.size();
+		return *this;
+	}
+};
+
+template<std::size_t N>
+struct SQL {
+	char chars[N + 1] { };
+	std::size_t size = 0;
+
+	constexpr SQL& operator<<(std::string_view sql) {
+		for (char c : sql)
+			chars[size++] = c;
+		return *this;
+	}
+
+	constexpr std::string_view view() const {
+		return { chars, N };
+	}
+};
+
+/** @return the SQL written by Generator::write, as a null-terminated constant of exactly the right size */
+template<typename Generator>
+constexpr auto generate() {
+	constexpr std::size_t size = [] {
+		SQLLength length;
+		Generator::write(length);
+		return length.size;
+	}();
+	SQL<size> sql;
+	Generator::write(sql);
+	return sql;
+}
+
+}
+
+template<Name ColumnName, typename T, unsigned Constraints = NONE>
+struct Column {
+	using type = T;
+	static constexpr std::string_view name = ColumnName.view();
+
+	template<typename Writer>
+	static constexpr void write_definition(Writer& sql) {
+		// same clause order as SQLite3DB::Column
+		sql << name << " " << detail::sql_type<T>()
+			<< (Constraints & PRIMARY_KEY ? " PRIMARY KEY" : "")
+			<< (detail::is_optional<T>::value ? "" : " NOT NULL")
+			<< (Constraints & UNIQUE && !(Constraints & PRIMARY_KEY) ? " UNIQUE" : "");
+	}
+};
+
+/** a set of column names, e.g. the columns to set or to match in an UPDATE */
+template<Name ... ColumnNames>
+struct Columns {
+};
+
+template<Name TableName, typename ... ColumnTs>
+struct Table {
+	static_assert(sizeof...(ColumnTs) > 0, "table without columns");
+
+	static constexpr std::string_view name = TableName.view();
+	static constexpr std::array<std::string_view, sizeof...(ColumnTs)> column_names { ColumnTs::name ... };
+
+	using row_type = std::tuple<typename ColumnTs::type ...>;
+
+	template<Name ColumnName>
+	static constexpr std::size_t index_of() {
+		constexpr std::size_t index = std::find(column_names.begin(), column_names.end(), ColumnName.view()) - column_names.begin();
+		static_assert(index < column_names.size(), "no such column");
+		return index;
+	}
+
+	template<Name ColumnName>
+	using column_t = std::tuple_element_t<index_of<ColumnName>(), std::tuple<ColumnTs ...> >;
+
+	template<typename ColumnSet> struct values;
+	template<Name ... ColumnNames>
+	struct values<Columns<ColumnNames ...> > {
+		using type = std::tuple<typename column_t<ColumnNames>::type ...>;
+	};
+	/** the row type of a subset of columns */
+	template<typename ColumnSet>
+	using values_t = typename values<ColumnSet>::type;
+
+private:
+	struct CreateSQL {
+		template<typename Writer>
+		static constexpr void write(Writer& sql) {
+			sql << "CREATE TABLE " << name << "(";
+			std::size_t i = 0;
+			((sql << (i++ ? ", " : ""), ColumnTs::write_definition(sql)), ...);
+			sql << ");";
+		}
+	};
+
+	struct InsertSQL {
+		template<typename Writer>
+		static constexpr void write(Writer& sql) {
+			sql << "INSERT INTO " << name << " (";
+			for (std::size_t i = 0; i < column_names.size(); ++i)
+				sql << (i ? "," : "") << column_names[i];
+			sql << ") VALUES(";
+			for (std::size_t i = 0; i < column_names.size(); ++i)
+				sql << (i ? ",?" : "?");
+			sql << ");";
+		}
+	};
+
+	template<typename SetColumns, typename WhereColumns> struct UpdateSQL;
+	template<Name ... SetNames, Name ... WhereNames>
+	struct UpdateSQL<Columns<SetNames ...>, Columns<WhereNames ...> > {
+		static_assert(sizeof...(SetNames) > 0 && sizeof...(WhereNames) > 0, "UPDATE needs columns to set and to match");
+
+		template<typename Writer>
+		static constexpr void write(Writer& sql) {
+			sql << "UPDATE " << name << " SET ";
+			std::size_t i = 0;
+			((sql << (i++ ? ", " : "") << column_t<SetNames>::name << " = ?"), ...);
+			sql << " WHERE ";
+			i = 0;
+			((sql << (i++ ? " AND " : "") << column_t<WhereNames>::name << " = ?"), ...);
+			sql << ";";
+		}
+	};
+
+public:
+	static constexpr auto create_sql = detail::generate<CreateSQL>();
+	static constexpr auto insert_sql = detail::generate<InsertSQL>();
+
+	template<typename SetColumns, typename WhereColumns>
+	static constexpr auto update_sql = detail::generate<UpdateSQL<SetColumns, WhereColumns> >();
+};
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <cstdint>
+
+#include <SQLite3DB.hh>
+
+#ifndef INCLUDE_SHIMIYUU_SQLITE3DBWRITEQUEUE_HH_
+#define INCLUDE_SHIMIYUU_SQLITE3DBWRITEQUEUE_HH_
+
+namespace shimiyuu {
+
+/**
+ * Write-behind queue with group commit.
+ *
+ * Producers on any thread enqueue inserts and updates, a background thread applies them
+ * and commits every max_rows operations or max_delay after the first uncommitted one, whichever comes first.
+ * The queue takes over the connection: do not use db directly while the queue exists.
+ * Remaining operations are committed on destruction.
+ */
+class SQLite3DBWriteQueue {
+
+	struct Operation {
+		std::string table_name;
+		std::vector<std::pair<std::string, std::string> > column_data;
+		std::vector<std::pair<std::string, std::string> > column_data_conditions; // empty for inserts
+		bool update;
+	};
+
+	SQLite3DB& m_db;
+	const std::size_t m_max_rows;
+	const std::chrono::milliseconds m_max_delay;
+
+	std::mutex m_mtx;
+	std::condition_variable m_work_available;
+	std::condition_variable m_committed;
+	std::deque<Operation> m_pending;
+	std::uint64_t m_enqueued = 0; // sequence number of the last enqueued operation
+	std::uint64_t m_durable = 0; // sequence number of the last committed operation
+	std::uint64_t m_flush_target = 0;
+	std::exception_ptr m_error;
+	bool m_stop = false;
+
+	std::thread m_writer;
+
+	void enqueue(Operation op);
+	void run();
+
+public:
+	SQLite3DBWriteQueue(SQLite3DB& db, std::size_t max_rows = 1000,
+			std::chrono::milliseconds max_delay = std::chrono::milliseconds { 100 });
+	~SQLite3DBWriteQueue();
+
+	SQLite3DBWriteQueue(const SQLite3DBWriteQueue&) = delete;
+	SQLite3DBWriteQueue& operator=(const SQLite3DBWriteQueue&) = delete;
+
+	/** enqueue SQLite3DB::insert(table_name, column_data) */
+	void insert(std::string_view table_name, std::vector<std::pair<std::string, std::string> > column_data);
+
+	/** enqueue SQLite3DB::update(table_name, new_column_data, column_data_conditions) */
+	void update(std::string_view table_name,
+			std::vector<std::pair<std::string, std::string> > new_column_data,
+			std::vector<std::pair<std::string, std::string> > column_data_conditions);
+
+	/**
+	 * Commit immediately and block until every operation enqueued before the call is durable.
+	 * @throw	the first error raised by an operation since the last flush (the failed operation is skipped)
+	 */
+	void flush();
+};
+
+}
+
+#endif
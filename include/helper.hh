@@ -1,5 +1,7 @@
 #include <string>
 #include <string_view>
+#include <vector>
+#include <span>
 #include <iterator>
 #include <sstream>
 #include <filesystem>
@@ -13,6 +15,19 @@ namespace shimiyuu::helper {
 
 std::string timestamp();
 
+/** length of a timestamp: HH:MM:SS.mmm */
+inline constexpr std::size_t timestamp_length = 12;
+
+/**
+ * Write the current local time as HH:MM:SS.mmm into buffer, without allocating.
+ * HH:MM:SS is formatted once per second and thread, and reused until the second changes.
+ * @return	a view of buffer
+ */
+std::string_view timestamp(std::span<char, timestamp_length> buffer);
+
+/** timestamp() formatted from scratch on every call with std::put_time, without the per-thread cache */
+std::string timestamp_uncached();
+
 bool is_valid_date(int d, int m, int y);
 
 bool is_valid_date(std::string_view date);
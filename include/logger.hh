@@ -7,46 +7,251 @@
 #include <string>
 #include <chrono>
 #include <ctime>
+#include <sstream>
+#include <optional>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <array>
+#include <climits>
 
 #include <helper.hh>
 
 #ifndef INCLUDE_SHIMIYUU_LOGGER_HH_
 #define INCLUDE_SHIMIYUU_LOGGER_HH_
 
+/**
+ * Log statements written through SYLOG at a level below this one are compiled out,
+ * e.g. -DSHIMIYUU_LOG_MIN_LEVEL=1 (for integral or enumeration log levels)
+ */
+#ifndef SHIMIYUU_LOG_MIN_LEVEL
+#define SHIMIYUU_LOG_MIN_LEVEL LLONG_MIN
+#endif
+
+/**
+ * SYLOG(logger, level) << ... is logger(level) << ..., except that the message is not evaluated at all
+ * when the level is disabled, and compiled out when it is below SHIMIYUU_LOG_MIN_LEVEL
+ */
+#define SYLOG(logger, level) \
+	if (static_cast<long long>(level) < SHIMIYUU_LOG_MIN_LEVEL || !(logger).writes(level)) ; else (logger)(level)
+
 namespace shimiyuu {
 
+/**
+ * Writes log lines to their streams on a background thread.
+ *
+ * Lines are pushed onto a bounded lock-free ring by any number of threads and drained by one thread,
+ * which flushes the streams whenever it catches up. When the ring is full, push(..) either waits for room
+ * (BLOCK) or drops the line and counts it (DROP). Streams given to push(..) must only be written through
+ * this SYAsyncLog, and must outlive it. Lines pushed during destruction are lost.
+ */
+class SYAsyncLog {
+
+public:
+	enum class Overflow {
+		BLOCK, DROP
+	};
+
+	explicit SYAsyncLog(std::size_t capacity = 4096, Overflow overflow = Overflow::BLOCK) :
+			m_cells(new Cell[std::bit_ceil(std::max<std::size_t>(capacity, 2))]),
+			m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+			m_overflow(overflow) {
+		for (std::size_t i = 0; i <= m_mask; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		m_thread = std::thread(&SYAsyncLog::drain, this);
+	}
+
+	/** write everything pushed so far, then stop the background thread */
+	~SYAsyncLog() {
+		m_stop.store(true, std::memory_order_release);
+		m_published.fetch_add(1, std::memory_order_release);
+		m_published.notify_one();
+		m_thread.join();
+	}
+
+	SYAsyncLog(const SYAsyncLog&) = delete;
+	SYAsyncLog& operator=(const SYAsyncLog&) = delete;
+
+	/** queue line to be written to os @return	false if it was dropped */
+	bool push(std::ostream& os, std::string line) {
+		std::size_t pos = m_enqueued.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true) {
+			cell = &m_cells[pos & m_mask];
+			const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			if (sequence == pos) {
+				if (m_enqueued.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			} else if (sequence < pos) { // full: the cell still holds the line from one lap ago
+				if (m_overflow == Overflow::DROP) {
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				const std::size_t dequeued = m_dequeued.load(std::memory_order_acquire);
+				if (cell->sequence.load(std::memory_order_acquire) < pos) m_dequeued.wait(dequeued, std::memory_order_acquire);
+				pos = m_enqueued.load(std::memory_order_relaxed);
+			} else
+				pos = m_enqueued.load(std::memory_order_relaxed);
+		}
+		cell->os = &os;
+		cell->line = std::move(line);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		m_published.fetch_add(1, std::memory_order_release);
+		m_published.notify_one();
+		return true;
+	}
+
+	/** block until every line pushed before the call is written and its stream flushed */
+	void flush() {
+		const std::size_t target = m_enqueued.load(std::memory_order_acquire);
+		for (std::size_t written = m_written.load(std::memory_order_acquire); written < target;
+				written = m_written.load(std::memory_order_acquire))
+			m_written.wait(written, std::memory_order_acquire);
+	}
+
+	/** @return	the number of lines dropped because the ring was full */
+	std::uint64_t dropped() const {
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Cell {
+		std::atomic<std::size_t> sequence; // pos: free for the push at pos, pos + 1: holds its line
+		std::ostream* os;
+		std::string line;
+	};
+
+	void drain() {
+		static constexpr std::size_t max_unflushed = 256;
+		std::vector<std::ostream*> unflushed;
+		std::size_t pos = 0;
+		while (true) {
+			const std::uint64_t published = m_published.load(std::memory_order_acquire);
+			Cell& cell = m_cells[pos & m_mask];
+			const bool ready = cell.sequence.load(std::memory_order_acquire) == pos + 1;
+			if (ready) {
+				*cell.os << cell.line;
+				if (std::find(unflushed.begin(), unflushed.end(), cell.os) == unflushed.end()) unflushed.push_back(cell.os);
+				cell.line.clear();
+				cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+				m_dequeued.store(++pos, std::memory_order_release);
+				m_dequeued.notify_all();
+				if (pos % max_unflushed) continue;
+			}
+
+			for (std::ostream* os : unflushed)
+				os->flush();
+			unflushed.clear();
+			m_written.store(pos, std::memory_order_release);
+			m_written.notify_all();
+
+			if (!ready) {
+				if (m_stop.load(std::memory_order_acquire) && pos == m_enqueued.load(std::memory_order_acquire)) return;
+				m_published.wait(published, std::memory_order_acquire);
+			}
+		}
+	}
+
+	const std::unique_ptr<Cell[]> m_cells;
+	const std::size_t m_mask;
+	const Overflow m_overflow;
+
+	alignas(64) std::atomic<std::size_t> m_enqueued = 0; // claimed by producers
+	alignas(64) std::atomic<std::size_t> m_dequeued = 0; // written by the background thread
+	std::atomic<std::size_t> m_written = 0; // written and flushed
+	std::atomic<std::uint64_t> m_published = 0; // wakes the background thread
+	std::atomic<std::uint64_t> m_dropped = 0;
+	std::atomic<bool> m_stop = false;
+
+	std::thread m_thread; // last: started once everything else is set up
+};
+
 namespace {
 class SYLoggerRelay {
 	std::ostream* os;
+	SYAsyncLog* async;
+	std::optional<std::ostringstream> line; // assembled for async
 
 public:
 
-	SYLoggerRelay(std::ostream* os) : os(os) {
-		if (os) *os << "[" << helper::timestamp() << "] ";
+	SYLoggerRelay(std::ostream* os, SYAsyncLog* async = nullptr) : os(os), async(async) {
+		if (os && async) line.emplace();
+		if (os) {
+			char timestamp[helper::timestamp_length];
+			stream() << "[" << helper::timestamp(timestamp) << "] ";
+		}
+	}
+
+	~SYLoggerRelay() {
+		if (line) async->push(*os, std::move(*line).str());
 	}
 
+	SYLoggerRelay(const SYLoggerRelay&) = delete;
+	SYLoggerRelay& operator=(const SYLoggerRelay&) = delete;
+
 	template<typename MessageT>
 	SYLoggerRelay& operator<<(const MessageT& message) {
-		if (os) *os << message;
+		if (os) stream() << message;
 		return *this;
 	}
 
 	SYLoggerRelay& operator<<(std::ostream& (*manip)(std::ostream&)) {
-		if (os) manip(*os);
+		if (os) manip(stream());
 		return *this;
 	}
+
+private:
+	std::ostream& stream() {
+		return line ? *line : *os;
+	}
 };
 }
 
 template<typename LogLevelT>
 class SYLogger {
+	// integral and enumeration levels in [0, fast_levels) are looked up in m_streams instead of m_logs
+	static constexpr bool flat = std::is_integral_v<LogLevelT> || std::is_enum_v<LogLevelT>;
+	static constexpr long long fast_levels = 32;
+
 	std::map<LogLevelT, std::pair<bool, std::ostream*> > m_logs;
 	const LogLevelT* m_level;
+	std::array<std::ostream*, fast_levels> m_streams { }; // null unless the level is written
+	SYAsyncLog* m_async = nullptr;
+
+	static bool fast(const LogLevelT& level) {
+		return static_cast<long long>(level) >= 0 && static_cast<long long>(level) < fast_levels;
+	}
+
+	/** @return	the stream statements at level are written to, or null */
+	std::ostream* stream(const LogLevelT& level) const {
+		if constexpr (flat) {
+			if (fast(level)) return m_streams[static_cast<long long>(level)];
+		}
+		if (level >= *m_level) {
+			if (const auto it = m_logs.find(level); it != m_logs.end()) {
+				const auto& [enabled, level_log] = it->second;
+				if (enabled) return level_log;
+			}
+		}
+		return nullptr;
+	}
+
+	void update_streams() {
+		if constexpr (flat) {
+			m_streams.fill(nullptr);
+			for (const auto& [level, log] : m_logs)
+				if (fast(level) && level >= *m_level && log.first) m_streams[static_cast<long long>(level)] = log.second;
+		}
+	}
 
 public:
 	SYLogger(const LogLevelT& level, std::ostream& log) :
 			m_logs { { level, { true, &log } } },
 			m_level(&m_logs.begin()->first) {
+		update_streams();
 	}
 
 	/**
@@ -56,14 +261,21 @@ public:
 	 * 			to the stream associated to level.
 	 */
 	SYLoggerRelay operator()(const LogLevelT& level) const {
-		std::ostream* log = nullptr;
-		if (level >= *m_level) {
-			if (const auto it = m_logs.find(level); it != m_logs.end()) {
-				const auto& [enabled, level_log] = it->second;
-				if (enabled) log = level_log;
-			}
+		return SYLoggerRelay(stream(level), m_async);
+	}
+
+	/** call write with the stream object for level only if it is written, see SYLOG for a statement form */
+	template<typename WriteT>
+	void operator()(const LogLevelT& level, WriteT&& write) const {
+		if (std::ostream* log = stream(level)) {
+			SYLoggerRelay relay(log, m_async);
+			write(relay);
 		}
-		return SYLoggerRelay(log);
+	}
+
+	/** @return	whether statements at level are written anywhere */
+	bool writes(const LogLevelT& level) const {
+		return stream(level);
 	}
 
 	/** set the log level of the logger
@@ -74,6 +286,7 @@ public:
 			m_level = &it->first;
 		else
 			throw std::runtime_error("log level not defined");
+		update_streams();
 	}
 
 	/**
@@ -90,6 +303,7 @@ public:
 	void level(const LogLevelT& level, std::ostream& log, bool active = false) {
 		auto it = m_logs.insert( { level, { true, &log } }).first;
 		if (active) m_level = &it->first;
+		update_streams();
 	}
 
 	/**
@@ -109,10 +323,19 @@ public:
 	bool enabled(const LogLevelT& level, bool enable) {
 		if (auto it = m_logs.find(level); it != m_logs.end()) {
 			it->second.first = enable;
+			update_streams();
 			return true;
 		} else
 			return false;
 	}
+
+	/**
+	 * Assemble each log statement into a line and hand it to async to write, instead of writing
+	 * on the calling thread (nullptr to write synchronously again). async must outlive its use
+	 */
+	void async(SYAsyncLog* async) {
+		m_async = async;
+	}
 };
 
 }
@@ -2,18 +2,65 @@
 #include <vector>
 #include <ostream>
 #include <map>
+#include <span>
+#include <cstddef>
+#include <functional>
+#include <atomic>
+#include <filesystem>
 
 #include <curl/curl.h>
 
+#include <network/curl_metrics.hh>
+
 #ifndef INCLUDE_SHIMIYUU_NETWORK_CURL_HH_
 #define INCLUDE_SHIMIYUU_NETWORK_CURL_HH_
 
 namespace shimiyuu::network {
 
+class CurlShare;
+
 class Curl {
+	friend class CurlMulti;
+	friend class CurlShare;
+	friend class CurlPool;
+	friend class HttpCache;
+	friend class CurlLoop;
 
 public:
+	enum class ChunkAction {
+		CONTINUE, PAUSE, ABORT
+	};
+	/** receives the body of a transfer chunk by chunk, see stream(..) */
+	using ChunkSink = std::function<ChunkAction(std::span<const std::byte> chunk)>;
+	/** fills buffer with the next bytes of a request body @return	the number of bytes written, 0 at the end. Throw to abort */
+	using BodySource = std::function<std::size_t(std::span<std::byte> buffer)>;
+
+	/** one part of a multipart/form-data body, see post_multipart(..) */
+	struct Part {
+		std::string name;
+		std::string value;
+		std::filesystem::path path;
+		BodySource source;
+		curl_off_t size = -1;
+		std::string filename, content_type;
+
+		static Part field(const std::string& name, const std::string& value);
+		/** read from path while sending, with path's file name */
+		static Part file(const std::string& name, const std::filesystem::path& path, const std::string& content_type = "");
+		/** read from source while sending, size bytes if known (-1 otherwise) */
+		static Part stream(const std::string& name, const std::string& filename, BodySource source, curl_off_t size = -1,
+				const std::string& content_type = "");
+	};
+
+	struct Response {
+		long status;
+		std::string body;
+		std::map<std::string, std::string> headers; // names in lower case, of the last response when redirected
+	};
+
 	Curl();
+	/** use DNS cache, TLS sessions (and cookies, if configured) of share, which must outlive *this */
+	Curl(CurlShare& share);
 	~Curl();
 
 	Curl(const Curl&) = delete;
@@ -22,13 +69,67 @@ public:
 	void set_cookies(const std::string& cookies) const;
 	void set_referer(const std::string& referer) const;
 	void set_headers(const std::vector<std::string>& headers = { });
+	/** ask for gzip, deflate, br or zstd encoded responses, as supported by libcurl, and decode them transparently */
+	void set_compression(bool enable) const;
+	/**
+	 * Use HTTP/2 where the server supports it over TLS (or always for http:// URLs with prior_knowledge),
+	 * and make concurrent transfers of a CurlMulti or CurlLoop wait to share one multiplexed connection per host
+	 * instead of opening more
+	 */
+	void set_http2(bool enable, bool prior_knowledge = false) const;
 
 	std::string get_string(const std::string& url) const;
+	/** GET url, sending extra_headers in addition to those set by set_headers */
+	Response get(const std::string& url, const std::vector<std::string>& extra_headers = { }) const;
+	/** POST data as application/x-www-form-urlencoded, escaping keys and values */
 	std::string post(const std::string& url, const std::map<std::string, std::string>& data) const;
+	/** POST parts as multipart/form-data. File and stream parts are read while sending, never held in memory */
+	std::string post_multipart(const std::string& url, const std::vector<Part>& parts) const;
+	/** POST the contents of file as the request body, read while sending */
+	std::string upload(const std::string& url, const std::filesystem::path& file,
+			const std::string& content_type = "application/octet-stream") const;
+	/**
+	 * POST the bytes produced by source as the request body, read while sending.
+	 * @param size	the length of the body, or -1 if unknown: the body is then sent with chunked transfer encoding
+	 */
+	std::string upload(const std::string& url, const BodySource& source, curl_off_t size,
+			const std::string& content_type = "application/octet-stream") const;
 	void write(const std::string& url, std::ostream& os) const;
 
+	/**
+	 * GET url and hand each chunk of the body to sink as soon as it is received, without buffering the body.
+	 * When sink returns PAUSE, the transfer stalls until resume() is called and then delivers the same chunk again.
+	 * @throw	runtime_error if the transfer fails or sink returns ABORT
+	 */
+	void stream(const std::string& url, const ChunkSink& sink) const;
+
+	/**
+	 * Download url into file over up to segments concurrent byte range requests, written in place into the preallocated file.
+	 * Progress is recorded in a sidecar file (file + ".download"), so that calling download again after a failure
+	 * only fetches the missing ranges, as long as the size and ETag / Last-Modified of the resource are unchanged
+	 * and file still has that size. Without an ETag or Last-Modified, the download always starts over.
+	 * Falls back to a single GET when the server does not report the size or does not accept byte ranges,
+	 * or answers a range request with the whole resource.
+	 * @throw	runtime_error if a transfer fails, after saving the progress made
+	 */
+	void download(const std::string& url, const std::filesystem::path& file, unsigned segments = 4) const;
+
+	/** continue a transfer paused by a ChunkSink, from any thread. Takes effect within about a second */
+	void resume() const;
+
+	/** @return	a ChunkSink writing to the file descriptor fd, aborting the transfer on write errors */
+	static ChunkSink fd_sink(int fd);
+
 	std::vector<std::string> get_cookies() const;
 
+	/**
+	 * Also record the metrics of every transfer into aggregate, which must outlive *this (nullptr to stop).
+	 * This includes the ranged requests of download and the transfers of a CurlMulti or CurlLoop with *this as prototype.
+	 */
+	void metrics(CurlMetrics* aggregate);
+	/** @return	the timings of the last get_string, get, post, write or stream */
+	const TransferMetrics& last_metrics() const;
+
 private:
 	class Global {
 	public:
@@ -41,11 +142,85 @@ private:
 
 	static std::size_t write_string(void* chunk, size_t size, size_t nmemb, void* buf);
 	static std::size_t write_to_stream(void* chunk, size_t size, size_t nmemb, void* buf);
+	static std::size_t write_header(char* line, size_t size, size_t nmemb, void* headers);
+	static std::size_t read_from_source(char* buffer, size_t size, size_t nitems, void* source);
+
+	/** @return	data as an application/x-www-form-urlencoded body */
+	static std::string form_encode(const std::map<std::string, std::string>& data);
+
+	struct StreamState {
+		const Curl& curl;
+		const ChunkSink& sink;
+		bool aborted = false;
+		bool paused = false; // by the last chunk, until unpause_on_resume continues the transfer
+	};
+	static std::size_t write_to_sink(void* chunk, size_t size, size_t nmemb, void* state);
+	static int unpause_on_resume(void* state, curl_off_t, curl_off_t, curl_off_t, curl_off_t);
+
+	struct Segment {
+		int fd;
+		curl_off_t begin, end; // byte range [begin, end)
+		curl_off_t done; // bytes written from begin
+		CURL* handle = nullptr;
+		curl_off_t length = 0; // of the whole resource
+		bool started = false; // the response was checked against the requested range
+		bool whole = false; // the server ignored the range and answered with the whole resource
+	};
+	/** closes a file descriptor on destruction */
+	class FileDescriptor {
+		const int m_fd;
+
+	public:
+		explicit FileDescriptor(int fd);
+		~FileDescriptor();
+
+		FileDescriptor(const FileDescriptor&) = delete;
+		FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+		int get() const;
+	};
+	/** the multi handle of a segmented download, cleaning up the segments' handles on destruction */
+	class SegmentTransfers {
+		std::vector<Segment>& m_parts;
+
+	public:
+		CURLM* const multi;
+
+		explicit SegmentTransfers(std::vector<Segment>& parts);
+		~SegmentTransfers();
+
+		SegmentTransfers(const SegmentTransfers&) = delete;
+		SegmentTransfers& operator=(const SegmentTransfers&) = delete;
+	};
+	static std::size_t write_to_segment(void* chunk, size_t size, size_t nmemb, void* segment);
+	static bool load_progress(const std::filesystem::path& sidecar, curl_off_t length, const std::string& validator,
+			std::vector<Segment>& segments);
+	static void save_progress(const std::filesystem::path& sidecar, curl_off_t length, const std::string& validator,
+			const std::vector<Segment>& segments);
+
+	/**
+	 * @return	a copy of m_handle with the options currently set, attached to the share.
+	 * 			The copy sends headers, a copy of the current header list that the caller frees after the copy
+	 */
+	CURL* duplicate(curl_slist*& headers) const;
+
+	/** update m_last_metrics from m_handle after a transfer, and record them */
+	void collect_metrics(CURLcode result) const;
+	/** record the metrics of a transfer made by another handle on behalf of *this, e.g. by a CurlMulti */
+	void record_metrics(CURL* handle, CURLcode result) const;
+	static TransferMetrics read_metrics(CURL* handle);
 
 	void reset_headers();
+	void set_defaults();
+	/** restore the options and state of a new instance, keeping connections and share */
+	void reset();
 
 	CURL* m_handle;
+	CurlShare* m_share = nullptr;
 	curl_slist* m_current_headers = nullptr; // libcurl does not copy entries > list must live until headers are reset
+	mutable std::atomic<bool> m_resume = false;
+	mutable TransferMetrics m_last_metrics;
+	CurlMetrics* m_metrics = nullptr;
 };
 
 }
@@ -0,0 +1,116 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <ostream>
+#include <optional>
+#include <coroutine>
+
+#include <curl/curl.h>
+
+#include <network/curl.hh>
+#include <network/task.hh>
+
+#ifndef INCLUDE_SHIMIYUU_NETWORK_CURL_LOOP_HH_
+#define INCLUDE_SHIMIYUU_NETWORK_CURL_LOOP_HH_
+
+namespace shimiyuu::network {
+
+/**
+ * An event loop on its own thread running any number of transfers, driven by curl_multi_socket_action and epoll.
+ *
+ * get_string, post and write return awaitables: co_await suspends the coroutine until the transfer completes,
+ * then resumes it on the loop's thread. Resumed coroutines should hand long work to other threads, as they hold up the loop.
+ * Every transfer is made with a copy of the prototype Curl as it was when *this was constructed:
+ * later changes to the prototype do not apply. The prototype must outlive *this.
+ * Transfers still running on destruction fail with CURLE_ABORTED_BY_CALLBACK.
+ */
+class CurlLoop {
+
+	struct Transfer {
+		CurlLoop& loop;
+		std::string url;
+		std::optional<std::string> post_data;
+		std::ostream* os = nullptr;
+		std::string body;
+		CURLcode result = CURLE_OK;
+		std::coroutine_handle<> awaiting;
+
+		Transfer(CurlLoop& loop, std::string url, std::optional<std::string> post_data, std::ostream* os);
+	};
+
+public:
+	/** co_await for the response body of a get_string or post, or nothing for a write */
+	template<typename T>
+	class [[nodiscard]] Awaitable {
+		friend class CurlLoop;
+
+		Transfer m_transfer;
+
+		Awaitable(Transfer transfer) :
+				m_transfer(std::move(transfer)) {
+		}
+
+	public:
+		bool await_ready() const {
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> awaiting) {
+			m_transfer.awaiting = awaiting;
+			return m_transfer.loop.enqueue(&m_transfer);
+		}
+
+		/** @throw	runtime_error if the transfer failed */
+		T await_resume() {
+			CurlLoop::check(m_transfer);
+			if constexpr (!std::is_void_v<T>) return std::move(m_transfer.body);
+		}
+	};
+
+	CurlLoop(const Curl& prototype);
+	~CurlLoop();
+
+	CurlLoop(const CurlLoop&) = delete;
+	CurlLoop& operator=(const CurlLoop&) = delete;
+
+	Awaitable<std::string> get_string(const std::string& url);
+	Awaitable<std::string> post(const std::string& url, const std::map<std::string, std::string>& data);
+	/** the stream is written from the loop's thread */
+	Awaitable<void> write(const std::string& url, std::ostream& os);
+
+private:
+	static void check(const Transfer& transfer);
+	static int on_socket(CURL* handle, curl_socket_t socket, int what, void* loop, void* registered);
+	static int on_timer(CURLM* multi, long timeout_ms, void* loop);
+
+	/** @return	false if the loop has stopped: the transfer failed without suspending */
+	bool enqueue(Transfer* transfer);
+	void run();
+	void start_queued();
+	void finish(CURL* handle, CURLcode result);
+
+	const Curl& m_prototype;
+	CURLM* m_multi;
+	curl_slist* m_headers = nullptr; // of m_template and the handles copied from it
+	CURL* m_template; // copy of the prototype, handles for transfers are copied from
+	int m_epoll, m_timer, m_wakeup; // file descriptors
+
+	std::mutex m_queue_mtx;
+	std::deque<Transfer*> m_queue;
+	bool m_stopped = false; // by the loop's thread: no more transfers are accepted
+	std::atomic<bool> m_stop = false;
+
+	// only used by the loop's thread
+	std::map<CURL*, Transfer*> m_active;
+	std::vector<CURL*> m_idle_handles;
+
+	std::thread m_thread; // last: started once everything else is set up
+};
+
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include <string>
+#include <map>
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#include <curl/curl.h>
+
+#include <logger.hh>
+
+#ifndef INCLUDE_SHIMIYUU_NETWORK_CURL_METRICS_HH_
+#define INCLUDE_SHIMIYUU_NETWORK_CURL_METRICS_HH_
+
+namespace shimiyuu::network {
+
+extern SYLogger<int> curl_logger;
+
+/**
+ * Timings of one transfer as reported by libcurl, each measured from the start of the transfer.
+ * connect - dns and tls - connect are network time; first_byte - tls is roughly the time the server took to respond.
+ */
+struct TransferMetrics {
+	std::string host;
+	long status = 0; // 0 if no response was received
+	std::chrono::microseconds dns { 0 }, connect { 0 }, tls { 0 }, first_byte { 0 }, total { 0 };
+	curl_off_t bytes_received = 0, bytes_sent = 0;
+};
+
+/** Per-host aggregates of TransferMetrics, recorded by any number of Curl instances on any threads, see Curl::metrics(..) */
+class CurlMetrics {
+
+public:
+	struct Histogram {
+		std::uint64_t count = 0;
+		std::chrono::microseconds total { 0 }, max { 0 };
+		/** buckets[i] counts values less than 2^i microseconds, the last bucket all longer ones */
+		std::array<std::uint64_t, 24> buckets { };
+
+		void add(std::chrono::microseconds value);
+		std::chrono::microseconds mean() const;
+	};
+
+	/** durations of the phases of transfers, so that network time can be told apart from server time */
+	struct HostStatistics {
+		std::uint64_t transfers = 0;
+		std::uint64_t failures = 0; // transfer errors and responses >= 400
+		curl_off_t bytes_received = 0, bytes_sent = 0;
+		std::map<long, std::uint64_t> status_counts;
+		Histogram dns; // dns
+		Histogram connect; // connect - dns
+		Histogram tls; // tls - connect
+		Histogram server; // first_byte - tls: from the request being sent to the first byte of the response
+		Histogram total;
+	};
+
+	void record(const TransferMetrics& metrics, bool failed);
+
+	std::map<std::string, HostStatistics> snapshot() const;
+
+	/** @return	the aggregates recorded so far, starting over from zero */
+	std::map<std::string, HostStatistics> reset();
+
+	/** write a summary line per host to curl_logger at level */
+	void log(int level = 1) const;
+
+private:
+	mutable std::mutex m_mtx;
+	std::map<std::string, HostStatistics> m_hosts;
+};
+
+}
+
+#endif
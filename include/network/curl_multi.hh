@@ -0,0 +1,101 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <optional>
+
+#include <curl/curl.h>
+
+#include <network/curl.hh>
+#include <network/curl_scheduler.hh>
+
+#ifndef INCLUDE_SHIMIYUU_NETWORK_CURL_MULTI_HH_
+#define INCLUDE_SHIMIYUU_NETWORK_CURL_MULTI_HH_
+
+namespace shimiyuu::network {
+
+/**
+ * Runs many transfers concurrently on one thread with curl_multi.
+ *
+ * Transfers are queued by get_string / post from any thread and run by perform(), at most max_transfers at once.
+ * Every transfer is made with a copy of the prototype Curl as it was when *this was constructed, so cookies, referer
+ * and headers set on it before apply; later changes to the prototype do not. The prototype must outlive *this.
+ * Completion callbacks run on the thread calling perform().
+ */
+class CurlMulti {
+
+public:
+	struct Response {
+		std::string url;
+		CURLcode result;
+		long status;
+		std::string body;
+
+		bool ok() const;
+	};
+	using Callback = std::function<void(Response)>;
+
+	CurlMulti(const Curl& prototype, std::size_t max_transfers = 16, std::size_t max_host_connections = 4);
+	~CurlMulti();
+
+	CurlMulti(const CurlMulti&) = delete;
+	CurlMulti& operator=(const CurlMulti&) = delete;
+
+	void get_string(const std::string& url, Callback on_done);
+	void post(const std::string& url, const std::map<std::string, std::string>& data, Callback on_done);
+
+	/** @return the response body, or a runtime_error if the transfer fails. Only ready after perform() ran it */
+	std::future<std::string> get_string(const std::string& url);
+	std::future<std::string> post(const std::string& url, const std::map<std::string, std::string>& data);
+
+	/**
+	 * Start queued transfers only once scheduler grants them, holding its Permit until they finish
+	 * (nullptr to stop). Transfers to a throttled host are passed over for those to other hosts.
+	 * The scheduler must outlive *this.
+	 */
+	void scheduler(CurlScheduler* scheduler);
+
+	/** run transfers until all queued ones, including those queued by callbacks meanwhile, are done */
+	void perform();
+
+private:
+	struct Transfer {
+		std::string url;
+		std::optional<std::string> post_data;
+		Callback on_done;
+		std::string body;
+		CURL* handle = nullptr;
+		std::optional<CurlScheduler::Permit> permit;
+
+		Transfer(std::string url, std::optional<std::string> post_data, Callback on_done);
+	};
+
+	static std::future<std::string> future_body(std::shared_ptr<std::promise<std::string> > promise, Callback& on_done);
+
+	void enqueue(std::unique_ptr<Transfer> transfer);
+	void start(std::unique_ptr<Transfer> transfer);
+	void finish(CURL* handle, CURLcode result);
+	/** @return	how long to wait at most for transfers to progress before starting queued ones again */
+	std::chrono::milliseconds start_queued();
+
+	const Curl& m_prototype;
+	const std::size_t m_max_transfers;
+	CURLM* m_multi;
+	curl_slist* m_headers = nullptr; // of m_template and the handles copied from it
+	CURL* m_template; // copy of the prototype, handles for transfers are copied from
+	CurlScheduler* m_scheduler = nullptr;
+
+	std::mutex m_queue_mtx;
+	std::deque<std::unique_ptr<Transfer> > m_queue;
+
+	std::map<CURL*, std::unique_ptr<Transfer> > m_active;
+	std::vector<CURL*> m_idle_handles; // finished handles keep their options, reused for the next transfer
+};
+
+}
+
+#endif
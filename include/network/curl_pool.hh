@@ -0,0 +1,60 @@
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include <network/curl.hh>
+#include <network/curl_share.hh>
+
+#ifndef INCLUDE_SHIMIYUU_NETWORK_CURL_POOL_HH_
+#define INCLUDE_SHIMIYUU_NETWORK_CURL_POOL_HH_
+
+namespace shimiyuu::network {
+
+/**
+ * Reusable Curl handles for threads to check out and return.
+ * Returned handles are reset to their initial options but keep their open connections.
+ */
+class CurlPool {
+
+	CurlShare* const m_share;
+	const std::size_t m_max_handles;
+
+	std::mutex m_mtx;
+	std::condition_variable m_returned;
+	std::vector<std::unique_ptr<Curl> > m_idle;
+	std::size_t m_handles = 0;
+
+	void release(std::unique_ptr<Curl> curl);
+
+public:
+	class Lease {
+		CurlPool* m_pool;
+		std::unique_ptr<Curl> m_curl;
+
+	public:
+		Lease(CurlPool& pool, std::unique_ptr<Curl> curl);
+		~Lease();
+
+		Lease(Lease&&) = default;
+		Lease& operator=(Lease&&) = delete;
+
+		Curl& operator*() const;
+		Curl* operator->() const;
+	};
+
+	/**
+	 * @param share	shared by all handles of the pool if not null, must outlive the pool
+	 * @param max_handles	acquire() blocks while this many handles are checked out, 0 for no limit
+	 */
+	CurlPool(CurlShare* share = nullptr, std::size_t max_handles = 0);
+
+	CurlPool(const CurlPool&) = delete;
+	CurlPool& operator=(const CurlPool&) = delete;
+
+	[[nodiscard]] Lease acquire();
+};
+
+}
+
+#endif
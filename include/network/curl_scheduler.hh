@@ -0,0 +1,109 @@
+#include <string>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <optional>
+#include <limits>
+#include <cstdint>
+
+#include <network/curl.hh>
+
+#ifndef INCLUDE_SHIMIYUU_NETWORK_CURL_SCHEDULER_HH_
+#define INCLUDE_SHIMIYUU_NETWORK_CURL_SCHEDULER_HH_
+
+namespace shimiyuu::network {
+
+/**
+ * Paces requests from any number of threads: a token bucket per host limits the request rate,
+ * and at most max_in_flight requests run at once over all hosts.
+ *
+ * Waiting requests are granted in order of priority (then arrival) as soon as their host has a token
+ * and a slot is free, so a throttled host does not hold back requests to the others.
+ * For the blocking API, hold a Permit around the transfer; CurlMulti::scheduler(..) paces a CurlMulti.
+ */
+class CurlScheduler {
+
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct Limit {
+		double requests_per_second = std::numeric_limits<double>::infinity();
+		double burst = 1; // requests that may be sent at once after the host was idle
+	};
+
+	/** a granted request, counted as in flight until destroyed */
+	class Permit {
+		CurlScheduler* m_scheduler;
+
+	public:
+		Permit(CurlScheduler& scheduler);
+		~Permit();
+
+		Permit(Permit&& other);
+		Permit& operator=(Permit&&) = delete;
+	};
+
+	CurlScheduler(std::size_t max_in_flight);
+	/** @param default_limit	applies to hosts without a limit of their own */
+	CurlScheduler(std::size_t max_in_flight, Limit default_limit);
+
+	CurlScheduler(const CurlScheduler&) = delete;
+	CurlScheduler& operator=(const CurlScheduler&) = delete;
+
+	void limit(const std::string& host, Limit limit);
+
+	/** block until a request to url may be sent; higher priorities go first */
+	[[nodiscard]] Permit acquire(const std::string& url, int priority = 0);
+
+	/**
+	 * A Permit if a request to url may be sent now, without waiting.
+	 * Otherwise, retry_at is moved back to the earliest time a token is due for url's host (if it is earlier),
+	 * or left alone if only a free slot is missing.
+	 */
+	std::optional<Permit> try_acquire(const std::string& url, clock::time_point& retry_at, int priority = 0);
+
+	/** Curl::get_string(url) once a Permit was granted */
+	std::string get_string(const Curl& curl, const std::string& url, int priority = 0);
+
+private:
+	struct Bucket {
+		Limit limit;
+		double tokens;
+		clock::time_point refilled;
+
+		void refill(clock::time_point now);
+		clock::time_point next_token() const;
+	};
+
+	struct Waiter {
+		int priority;
+		std::uint64_t sequence;
+		Bucket* bucket;
+		mutable bool granted = false;
+
+		bool operator<(const Waiter& other) const;
+	};
+
+	static std::string host_of(const std::string& url);
+
+	Bucket& bucket(const std::string& url);
+	/** grant waiters in order while slots are free @return	the earliest time a token is due for a waiting host */
+	clock::time_point grant();
+	void release();
+
+	const std::size_t m_max_in_flight;
+	const Limit m_default_limit;
+
+	std::mutex m_mtx;
+	std::condition_variable m_changed;
+	std::map<std::string, Bucket> m_buckets;
+	std::set<Waiter> m_waiters;
+	std::uint64_t m_sequence = 0;
+	std::size_t m_in_flight = 0;
+};
+
+}
+
+#endif
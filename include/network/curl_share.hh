@@ -0,0 +1,39 @@
+#include <array>
+#include <mutex>
+
+#include <curl/curl.h>
+
+#ifndef INCLUDE_SHIMIYUU_NETWORK_CURL_SHARE_HH_
+#define INCLUDE_SHIMIYUU_NETWORK_CURL_SHARE_HH_
+
+namespace shimiyuu::network {
+
+/**
+ * State shared between any number of Curl instances, on any threads:
+ * DNS cache, TLS sessions and optionally cookies.
+ * A new Curl then reuses lookups and TLS sessions of the others, but opens its own connections:
+ * libcurl does not support sharing its connection pool between threads.
+ * Must outlive every Curl using it.
+ */
+class CurlShare {
+	friend class Curl;
+	friend class CurlMulti;
+	friend class CurlLoop;
+
+	CURLSH* m_share;
+	std::array<std::mutex, CURL_LOCK_DATA_LAST> m_locks;
+
+	static void lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* share);
+	static void unlock(CURL* handle, curl_lock_data data, void* share);
+
+public:
+	CurlShare(bool share_cookies = false);
+	~CurlShare();
+
+	CurlShare(const CurlShare&) = delete;
+	CurlShare& operator=(const CurlShare&) = delete;
+};
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <mutex>
+#include <cstdint>
+
+#include <SQLite3DB.hh>
+
+#include <network/curl.hh>
+
+#ifndef INCLUDE_SHIMIYUU_NETWORK_HTTP_CACHE_HH_
+#define INCLUDE_SHIMIYUU_NETWORK_HTTP_CACHE_HH_
+
+namespace shimiyuu::network {
+
+/**
+ * On-disk cache of GET responses, revalidated with conditional requests.
+ *
+ * Bodies are stored as files in the cache directory, indexed in a SQLite3DB by URL and request headers.
+ * Responses with an ETag or Last-Modified header are stored, and later requests for them send
+ * If-None-Match / If-Modified-Since: a 304 response is then served from disk.
+ * The least recently used entries are evicted when the stored bodies exceed max_bytes.
+ */
+class HttpCache {
+
+public:
+	struct Statistics {
+		std::uint64_t hits = 0; // served from disk after a 304
+		std::uint64_t misses = 0; // body transferred
+		std::uint64_t evictions = 0;
+		std::uint64_t stored_bytes = 0;
+	};
+
+	HttpCache(const std::filesystem::path& directory, std::uint64_t max_bytes);
+
+	HttpCache(const HttpCache&) = delete;
+	HttpCache& operator=(const HttpCache&) = delete;
+
+	/** Curl::get_string(url) through the cache, sending request_headers in addition to those set on curl */
+	std::string get_string(const Curl& curl, const std::string& url, const std::vector<std::string>& request_headers = { });
+
+	Statistics statistics() const;
+
+private:
+	struct Entry {
+		std::string file;
+		std::string etag;
+		std::string last_modified;
+	};
+
+	std::optional<Entry> lookup(const std::string& key);
+	void store(const std::string& key, const Curl::Response& response);
+	void touch(const std::string& key);
+	void evict();
+
+	const std::filesystem::path m_directory;
+	const std::uint64_t m_max_bytes;
+
+	mutable std::mutex m_mtx; // guards m_index and m_statistics, not held during transfers
+	SQLite3DB m_index;
+	Statistics m_statistics;
+};
+
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include <coroutine>
+#include <atomic>
+#include <exception>
+#include <variant>
+#include <utility>
+#include <future>
+#include <cstdint>
+
+#ifndef INCLUDE_SHIMIYUU_NETWORK_TASK_HH_
+#define INCLUDE_SHIMIYUU_NETWORK_TASK_HH_
+
+namespace shimiyuu::network {
+
+template<typename T>
+class Task;
+
+namespace detail {
+
+template<typename T>
+struct TaskResult {
+	std::variant<std::monostate, T, std::exception_ptr> result;
+
+	void return_value(T value) {
+		result.template emplace<1>(std::move(value));
+	}
+
+	T take() {
+		if (result.index() == 2) std::rethrow_exception(std::get<2>(result));
+		return std::move(std::get<1>(result));
+	}
+};
+
+template<>
+struct TaskResult<void> {
+	std::variant<std::monostate, std::exception_ptr> result;
+
+	void return_void() {
+	}
+
+	void take() {
+		if (result.index() == 1) std::rethrow_exception(std::get<1>(result));
+	}
+};
+
+}
+
+/**
+ * A coroutine returning T, started eagerly: it runs on the calling thread until its first suspension,
+ * then wherever the awaited operation resumes it (the thread of a CurlLoop for its transfers).
+ *
+ * co_await a Task for its result, which is moved out, or sync_wait(..) for it from a normal function.
+ * Destroying a Task before it completes detaches it: the coroutine runs to completion and frees itself.
+ */
+template<typename T>
+class Task {
+
+public:
+	struct promise_type : detail::TaskResult<T> {
+		// RUNNING, DONE, DETACHED or the address of the coroutine awaiting this one
+		std::atomic<std::uintptr_t> state = RUNNING;
+
+		Task get_return_object() {
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_never initial_suspend() noexcept {
+			return { };
+		}
+
+		auto final_suspend() noexcept {
+			struct Final {
+				bool await_ready() noexcept {
+					return false;
+				}
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept {
+					const std::uintptr_t previous = self.promise().state.exchange(DONE);
+					if (previous == DETACHED) self.destroy();
+					if (previous == RUNNING || previous == DETACHED) return std::noop_coroutine();
+					return std::coroutine_handle<>::from_address(reinterpret_cast<void*>(previous));
+				}
+				void await_resume() noexcept {
+				}
+			};
+			return Final { };
+		}
+
+		void unhandled_exception() {
+			this->result = std::current_exception();
+		}
+	};
+
+	Task(Task&& other) :
+			m_handle(std::exchange(other.m_handle, nullptr)) {
+	}
+
+	Task& operator=(Task&& other) {
+		if (this != &other) {
+			detach();
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+
+	~Task() {
+		detach();
+	}
+
+	bool await_ready() const {
+		return m_handle.promise().state == DONE;
+	}
+
+	/** @return	false if the task completed meanwhile, to continue the awaiting coroutine right away */
+	bool await_suspend(std::coroutine_handle<> awaiting) {
+		std::uintptr_t expected = RUNNING;
+		return m_handle.promise().state.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(awaiting.address()));
+	}
+
+	T await_resume() {
+		return m_handle.promise().take();
+	}
+
+private:
+	static constexpr std::uintptr_t RUNNING = 0, DONE = 1, DETACHED = 2;
+
+	std::coroutine_handle<promise_type> m_handle;
+
+	explicit Task(std::coroutine_handle<promise_type> handle) :
+			m_handle(handle) {
+	}
+
+	void detach() {
+		if (m_handle && m_handle.promise().state.exchange(DETACHED) == DONE) m_handle.destroy();
+		m_handle = nullptr;
+	}
+};
+
+/** block the calling thread until task completes @return	its result */
+template<typename T>
+T sync_wait(Task<T> task) {
+	struct Completion { // awaits task without taking its result
+		Task<T>& task;
+
+		bool await_ready() const {
+			return task.await_ready();
+		}
+		bool await_suspend(std::coroutine_handle<> awaiting) {
+			return task.await_suspend(awaiting);
+		}
+		void await_resume() const {
+		}
+	};
+
+	std::promise<void> done;
+	const Task<void> signal = [](Completion completion, std::promise<void>& done) -> Task<void> {
+		co_await completion;
+		done.set_value();
+	}(Completion { task }, done);
+	done.get_future().wait();
+	return task.await_resume();
+}
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdexcept>
+#include <system_error>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <optional>
+#include <exception>
+#include <algorithm>
+#include <iterator>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include <DelimitedImporter.hh>
+
+namespace shimiyuu {
+
+namespace {
+
+/** @return	name as a quoted SQL identifier */
+std::string quote_identifier(std::string_view name) {
+	std::string quoted("\"");
+	for (const char c : name)
+		quoted += c == '"' ? std::string("\"\"") : std::string(1, c);
+	return quoted + '"';
+}
+
+/** the fields of up to batch_rows records, row-major */
+struct Batch {
+	std::vector<std::string_view> fields;
+	std::deque<std::string> unescaped; // storage of quoted fields with escaped quotes, deque keeps views valid
+	std::size_t rows = 0;
+};
+
+class BatchQueue {
+	static constexpr std::size_t CAPACITY = 2; // parse at most this many batches ahead of the writer
+
+	std::mutex m_mtx;
+	std::condition_variable m_changed;
+	std::deque<Batch> m_batches;
+	bool m_done = false;
+	bool m_cancelled = false;
+	std::exception_ptr m_error;
+
+public:
+	/** @return false if the consumer gave up */
+	bool push(Batch batch) {
+		std::unique_lock lock { m_mtx };
+		m_changed.wait(lock, [this] {
+			return m_batches.size() < CAPACITY || m_cancelled;
+		});
+		if (m_cancelled) return false;
+		m_batches.push_back(std::move(batch));
+		m_changed.notify_all();
+		return true;
+	}
+
+	void finish(std::exception_ptr error = nullptr) {
+		std::scoped_lock lock { m_mtx };
+		m_done = true;
+		m_error = error;
+		m_changed.notify_all();
+	}
+
+	void cancel() {
+		std::scoped_lock lock { m_mtx };
+		m_cancelled = true;
+		m_changed.notify_all();
+	}
+
+	/** @return the next batch, or nothing once the producer finished */
+	std::optional<Batch> pop() {
+		std::unique_lock lock { m_mtx };
+		m_changed.wait(lock, [this] {
+			return !m_batches.empty() || m_done;
+		});
+		if (m_batches.empty()) {
+			if (m_error) std::rethrow_exception(m_error);
+			return std::nullopt;
+		}
+		Batch batch = std::move(m_batches.front());
+		m_batches.pop_front();
+		m_changed.notify_all();
+		return batch;
+	}
+};
+
+class Tokenizer {
+	const char* m_pos;
+	const char* const m_end;
+	const char m_delimiter, m_quote;
+	std::size_t m_line = 1;
+
+	std::string_view quoted_field(std::deque<std::string>& unescaped) {
+		const char* const begin = ++m_pos;
+		bool escaped = false;
+		while (true) {
+			const char* const quote = static_cast<const char*>(std::memchr(m_pos, m_quote, m_end - m_pos));
+			if (!quote) throw std::runtime_error("unterminated quoted field in line " + std::to_string(m_line));
+			m_pos = quote + 1;
+			if (m_pos < m_end && *m_pos == m_quote) {
+				escaped = true;
+				++m_pos;
+				continue;
+			}
+			std::string_view field(begin, quote - begin);
+			m_line += std::count(field.begin(), field.end(), '\n');
+			if (!escaped) return field;
+
+			std::string& copy = unescaped.emplace_back();
+			copy.reserve(field.size());
+			for (std::size_t i = 0; i < field.size(); ++i) {
+				copy += field[i];
+				if (field[i] == m_quote) ++i; // skip the second quote of each pair
+			}
+			return copy;
+		}
+	}
+
+public:
+	Tokenizer(std::string_view data, char delimiter, char quote) :
+			m_pos(data.data()), m_end(data.data() + data.size()), m_delimiter(delimiter), m_quote(quote) {
+	}
+
+	bool done() const {
+		return m_pos >= m_end;
+	}
+
+	std::size_t line() const {
+		return m_line;
+	}
+
+	/**
+	 * Append the fields of the next record to fields.
+	 * @return	the number of fields, 0 for an empty line
+	 */
+	std::size_t record(std::vector<std::string_view>& fields, std::deque<std::string>& unescaped) {
+		std::size_t count = 0;
+		while (true) {
+			if (m_pos < m_end && *m_pos == m_quote) {
+				fields.push_back(quoted_field(unescaped));
+			} else {
+				const char* begin = m_pos;
+				while (m_pos < m_end && *m_pos != m_delimiter && *m_pos != '\n')
+					++m_pos;
+				const char* end = m_pos;
+				if (m_pos < m_end && *m_pos == '\n' && end > begin && end[-1] == '\r') --end; // CRLF terminator, not data
+				if (count == 0 && end == begin && (m_pos == m_end || *m_pos == '\n')) { // empty line
+					if (m_pos < m_end) ++m_pos, ++m_line;
+					return 0;
+				}
+				fields.emplace_back(begin, end - begin);
+			}
+			++count;
+
+			if (m_pos < m_end && *m_pos == '\r' && m_pos + 1 < m_end && m_pos[1] == '\n') ++m_pos;
+			if (m_pos >= m_end) return count;
+			if (*m_pos == '\n') {
+				++m_pos;
+				++m_line;
+				return count;
+			}
+			if (*m_pos != m_delimiter) throw std::runtime_error("garbage after quoted field in line " + std::to_string(m_line));
+			++m_pos;
+		}
+	}
+};
+
+}
+
+DelimitedImporter::DelimitedImporter(const std::string& file) :
+		m_file(file) {
+	const int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) throw std::system_error(errno, std::generic_category(), "cannot open " + file);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		const int err = errno;
+		close(fd);
+		throw std::system_error(err, std::generic_category(), "cannot stat " + file);
+	}
+	m_size = st.st_size;
+	if (m_size > 0) {
+		void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		const int err = errno;
+		close(fd); // the mapping stays valid
+		if (data == MAP_FAILED) throw std::system_error(err, std::generic_category(), "cannot map " + file);
+		madvise(data, m_size, MADV_SEQUENTIAL);
+		m_data = static_cast<const char*>(data);
+	} else
+		close(fd);
+}
+
+DelimitedImporter::~DelimitedImporter() {
+	if (m_data) munmap(const_cast<char*>(m_data), m_size);
+}
+
+DelimitedImporter::Options DelimitedImporter::tsv() {
+	Options options;
+	options.delimiter = '\t';
+	return options;
+}
+
+DelimitedImporter::Statistics DelimitedImporter::import(SQLite3DB& db, std::string_view table_name, const Options& options) {
+	const auto start = std::chrono::steady_clock::now();
+	Tokenizer tokenizer(std::string_view(m_data, m_size), options.delimiter, options.quote);
+
+	std::vector<std::string> columns = options.columns;
+	if (options.header) {
+		std::vector<std::string_view> header;
+		std::deque<std::string> unescaped;
+		while (!tokenizer.done() && tokenizer.record(header, unescaped) == 0);
+		if (columns.empty())
+			std::transform(header.begin(), header.end(), std::back_inserter(columns), quote_identifier);
+	}
+	if (columns.empty()) throw std::runtime_error("no columns to import into");
+
+	BatchQueue queue;
+	std::thread parser([&] {
+		try {
+			while (!tokenizer.done()) {
+				Batch batch;
+				batch.fields.reserve(options.batch_rows * columns.size());
+				while (batch.rows < options.batch_rows && !tokenizer.done()) {
+					const std::size_t line = tokenizer.line();
+					std::size_t fields = tokenizer.record(batch.fields, batch.unescaped);
+					if (fields == 0) { // blank line
+						if (columns.size() != 1) continue;
+						batch.fields.emplace_back();
+						fields = 1;
+					}
+					if (fields != columns.size())
+						throw std::runtime_error(m_file + ": expected " + std::to_string(columns.size())
+							+ " fields, found " + std::to_string(fields) + " in line " + std::to_string(line));
+					++batch.rows;
+				}
+				if (batch.rows && !queue.push(std::move(batch))) return;
+			}
+			queue.finish();
+		} catch (...) {
+			queue.finish(std::current_exception());
+		}
+	});
+
+	Statistics statistics;
+	try {
+		std::optional<SQLite3DB::Transaction> transaction;
+		if (sqlite3_get_autocommit(db.m_db.get())) transaction.emplace(db);
+		while (std::optional<Batch> batch = queue.pop()) {
+			db.insert(table_name, columns, std::span<const std::string_view>(batch->fields), options.rows_per_statement);
+			statistics.rows += batch->rows;
+		}
+		if (transaction) transaction->commit();
+	} catch (...) {
+		queue.cancel();
+		parser.join();
+		throw;
+	}
+	parser.join();
+
+	statistics.bytes = m_size;
+	statistics.elapsed = std::chrono::steady_clock::now() - start;
+	SYLOG(sqlite3db_logger, 1) << "imported " << statistics.rows << " rows from " << m_file << " into " << table_name
+		<< ": " << statistics.mb_per_second() << " MB/s, " << statistics.rows_per_second() << " rows/s" << std::endl;
+	return statistics;
+}
+
+double DelimitedImporter::Statistics::mb_per_second() const {
+	return elapsed.count() > 0 ? bytes / 1e6 / elapsed.count() : 0;
+}
+
+double DelimitedImporter::Statistics::rows_per_second() const {
+	return elapsed.count() > 0 ? rows / elapsed.count() : 0;
+}
+
+}
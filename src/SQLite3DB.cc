@@ -1,5 +1,11 @@
 #include <stdexcept>
 #include <iostream>
+#include <optional>
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <exception>
+#include <set>
 
 #include <sqlite3.h>
 
@@ -9,13 +15,231 @@ namespace shimiyuu {
 
 SYLogger<int> sqlite3db_logger(2, std::cerr);
 
-SQLite3DB::SQLite3DB(const std::string& database_file) {
+SQLite3DB::SQLite3DB(const std::string& database_file) :
+		SQLite3DB(database_file, Options { }) {
+}
+
+SQLite3DB::SQLite3DB(const std::string& database_file, const Options& options) :
+		m_statement_cache_size(options.statement_cache_size) {
 	sqlite3* db;
-	if (sqlite3_open(database_file.c_str(), &db))
-		throw std::runtime_error(sqlite3_errmsg(db));
-	m_db.reset(db);
+	const int flags = options.read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	const int rc = sqlite3_open_v2(database_file.c_str(), &db, flags, nullptr);
+	m_db.reset(db); // sqlite3_open_v2 allocates a handle even on failure
+	if (rc != SQLITE_OK) throw std::runtime_error(sqlite3_errmsg(db));
 
 	exec("PRAGMA foreign_keys = on;");
+
+	if (options.busy_timeout_ms) sqlite3_busy_timeout(m_db.get(), *options.busy_timeout_ms);
+	if (options.journal_mode != JournalMode::DEFAULT)
+		exec("PRAGMA journal_mode = " + to_sql(options.journal_mode) + ";");
+	if (options.synchronous != Synchronous::DEFAULT)
+		exec("PRAGMA synchronous = " + std::to_string(static_cast<int>(options.synchronous) - 1) + ";");
+	if (options.cache_size_kib)
+		exec("PRAGMA cache_size = -" + std::to_string(*options.cache_size_kib) + ";");
+	if (options.mmap_size)
+		exec("PRAGMA mmap_size = " + std::to_string(*options.mmap_size) + ";");
+	if (options.temp_store != TempStore::DEFAULT)
+		exec("PRAGMA temp_store = " + std::to_string(static_cast<int>(options.temp_store)) + ";");
+
+	SYLOG(sqlite3db_logger, 1) << "opened " << database_file << ": " << settings().to_string() << std::endl;
+}
+
+void SQLite3DB::profile(bool enable, std::chrono::nanoseconds slow_threshold) {
+	if (!enable) {
+		sqlite3_trace_v2(m_db.get(), 0, nullptr, nullptr);
+		m_profile.reset();
+		return;
+	}
+	if (!m_profile) m_profile = std::make_unique<Profile>();
+	m_profile->slow_threshold = slow_threshold;
+	sqlite3_trace_v2(m_db.get(), SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE, trace, m_profile.get());
+}
+
+std::map<std::string, SQLite3DB::StatementStatistics> SQLite3DB::statistics() const {
+	if (!m_profile) return { };
+	std::scoped_lock lock { m_profile->mtx };
+	return { m_profile->statistics.begin(), m_profile->statistics.end() };
+}
+
+void SQLite3DB::reset_statistics() {
+	if (!m_profile) return;
+	std::scoped_lock lock { m_profile->mtx };
+	m_profile->statistics.clear();
+}
+
+/** replace string and numeric literals by ?, so executions differing only in values share statistics */
+static void normalize_sql(std::string_view sql, std::string& normalized) {
+	normalized.clear();
+	for (std::size_t i = 0; i < sql.size();) {
+		const char c = sql[i];
+		const bool word_before = !normalized.empty() && (std::isalnum(static_cast<unsigned char>(normalized.back())) || normalized.back() == '_');
+		if (c == '\'') {
+			for (++i; i < sql.size(); ++i) {
+				if (sql[i] != '\'') continue;
+				if (i + 1 < sql.size() && sql[i + 1] == '\'') ++i; // escaped quote
+				else break;
+			}
+			++i;
+			normalized += '?';
+		} else if (std::isdigit(static_cast<unsigned char>(c)) && !word_before) {
+			while (i < sql.size() && (std::isalnum(static_cast<unsigned char>(sql[i])) || sql[i] == '.')) ++i;
+			normalized += '?';
+		} else {
+			normalized += c;
+			++i;
+		}
+	}
+}
+
+int SQLite3DB::trace(unsigned type, void* profile_ptr, void* stmt_ptr, void*) {
+	auto& profile = *static_cast<Profile*>(profile_ptr);
+	auto* stmt = static_cast<sqlite3_stmt*>(stmt_ptr);
+	if (type == SQLITE_TRACE_STMT) {
+		profile.running.try_emplace(stmt, std::chrono::steady_clock::now()); // also invoked when triggers start
+		return 0;
+	}
+
+	const auto started = profile.running.find(stmt);
+	if (started == profile.running.end()) return 0; // started before profiling was enabled
+	const auto elapsed = std::chrono::steady_clock::now() - started->second;
+	profile.running.erase(started);
+	const sqlite3_int64 changes = sqlite3_stmt_readonly(stmt) ? 0 : sqlite3_changes64(sqlite3_db_handle(stmt));
+
+	const char* sql = sqlite3_sql(stmt);
+	thread_local std::string normalized;
+	normalize_sql(sql ? sql : "", normalized);
+
+	const auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+	const std::size_t bucket = std::min<std::size_t>(std::bit_width(static_cast<std::uint64_t>(us)),
+		std::tuple_size_v<decltype(StatementStatistics::latency_histogram)> - 1);
+	{
+		std::scoped_lock lock { profile.mtx };
+		auto it = profile.statistics.find(std::string_view(normalized));
+		if (it == profile.statistics.end()) it = profile.statistics.emplace(normalized, StatementStatistics { }).first;
+		StatementStatistics& stats = it->second;
+		++stats.calls;
+		stats.rows_changed += changes;
+		stats.total_time += elapsed;
+		stats.max_time = std::max(stats.max_time, elapsed);
+		++stats.latency_histogram[bucket];
+	}
+
+	if (elapsed > profile.slow_threshold) {
+		SYLOG(sqlite3db_logger, 2) << "slow statement (" << std::chrono::duration<double, std::milli>(elapsed).count()
+			<< " ms): " << sql << std::endl;
+	}
+	return 0;
+}
+
+void SQLite3DB::backup(const std::string& destination_file) {
+	backup(destination_file, BackupOptions { });
+}
+
+void SQLite3DB::backup(const std::string& destination_file, const BackupOptions& options) {
+	sqlite3* db;
+	const int rc = sqlite3_open(destination_file.c_str(), &db);
+	std::unique_ptr<sqlite3, sqlite3Deleter> destination(db);
+	if (rc != SQLITE_OK) throw std::runtime_error(sqlite3_errmsg(db));
+	backup_to(destination.get(), options);
+	SYLOG(sqlite3db_logger, 1) << "backed up to " << destination_file << std::endl;
+}
+
+SQLite3DB SQLite3DB::snapshot() {
+	return snapshot(BackupOptions { });
+}
+
+SQLite3DB SQLite3DB::snapshot(const BackupOptions& options) {
+	SQLite3DB copy(":memory:");
+	// an in-memory destination cannot change its page size once the backup has started
+	if (Query page_size(*this, "PRAGMA page_size;", { }); page_size.next())
+		Query(copy, "PRAGMA page_size = " + std::to_string(page_size.row().integer(0)) + ";", { }).next();
+	backup_to(copy.m_db.get(), options);
+	return copy;
+}
+
+void SQLite3DB::backup_to(sqlite3* destination, const BackupOptions& options) {
+	// In WAL mode, copy from one read transaction: it sees a fixed snapshot while writers go on, so commits on
+	// other connections do not restart the copy. Otherwise, it would block writers for the whole backup.
+	std::optional<Transaction> snapshot;
+	if (Query journal_mode(*this, "PRAGMA journal_mode;", { });
+			sqlite3_get_autocommit(m_db.get()) && journal_mode.next() && journal_mode.row().text(0) == "wal") {
+		snapshot.emplace(*this);
+		Query(*this, "SELECT 1 FROM sqlite_schema LIMIT 1;", { }).next(); // BEGIN is deferred: start reading now
+	}
+
+	sqlite3_backup* backup = sqlite3_backup_init(destination, "main", m_db.get(), "main");
+	if (!backup) throw std::runtime_error(sqlite3_errmsg(destination));
+
+	int rc;
+	bool aborted = false;
+	do {
+		rc = sqlite3_backup_step(backup, options.pages_per_step);
+		if (options.progress && !options.progress(sqlite3_backup_remaining(backup), sqlite3_backup_pagecount(backup))) {
+			aborted = true;
+			break;
+		}
+		if ((rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) && options.pause.count() > 0)
+			sqlite3_sleep(options.pause.count());
+	} while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+	sqlite3_backup_finish(backup);
+	if (aborted) throw std::runtime_error("backup aborted");
+	if (rc != SQLITE_DONE) throw std::runtime_error(sqlite3_errstr(rc));
+}
+
+SQLite3DB::Options SQLite3DB::Options::durable() {
+	Options options;
+	options.journal_mode = JournalMode::WAL;
+	options.synchronous = Synchronous::FULL;
+	return options;
+}
+
+SQLite3DB::Options SQLite3DB::Options::bulk_load() {
+	Options options;
+	options.journal_mode = JournalMode::WAL;
+	options.synchronous = Synchronous::OFF;
+	options.cache_size_kib = 256 * 1024;
+	options.temp_store = TempStore::MEMORY;
+	return options;
+}
+
+SQLite3DB::Options SQLite3DB::Options::read_mostly() {
+	Options options;
+	options.journal_mode = JournalMode::WAL;
+	options.synchronous = Synchronous::NORMAL;
+	options.cache_size_kib = 64 * 1024;
+	options.mmap_size = std::int64_t { 256 } * 1024 * 1024;
+	options.temp_store = TempStore::MEMORY;
+	return options;
+}
+
+SQLite3DB::Settings SQLite3DB::settings() {
+	auto pragma = [this](const std::string& name) {
+		Query query = this->query("PRAGMA " + name + ";");
+		if (!query.next()) throw std::runtime_error("PRAGMA " + name + " returned nothing");
+		return std::string(query.row().text(0));
+	};
+	return {
+		sqlite3_db_readonly(m_db.get(), "main") == 1,
+		pragma("journal_mode"),
+		static_cast<Synchronous>(std::stoi(pragma("synchronous")) + 1),
+		std::stoll(pragma("cache_size")),
+		std::stoll(pragma("mmap_size")),
+		static_cast<TempStore>(std::stoi(pragma("temp_store"))),
+		pragma("foreign_keys") == "1"
+	};
+}
+
+std::string SQLite3DB::Settings::to_string() const {
+	static const char* const SYNCHRONOUS[] { "?", "OFF", "NORMAL", "FULL", "EXTRA" };
+	static const char* const TEMP_STORE[] { "DEFAULT", "FILE", "MEMORY" };
+	return std::string(read_only ? "read_only " : "")
+		+ "journal_mode=" + journal_mode
+		+ " synchronous=" + SYNCHRONOUS[static_cast<int>(synchronous)]
+		+ " cache_size=" + std::to_string(cache_size)
+		+ " mmap_size=" + std::to_string(mmap_size)
+		+ " temp_store=" + TEMP_STORE[static_cast<int>(temp_store)]
+		+ " foreign_keys=" + (foreign_keys ? "on" : "off");
 }
 
 void SQLite3DB::sqlite3Deleter::operator()(sqlite3* db) const {
@@ -75,7 +299,7 @@ void SQLite3DB::create_with_constraints(std::string_view table_name, const std::
 			return col.constraint_sql();
 		})
 		+ constraint_clauses + ");";
-	sqlite3db_logger(0) << "constaint composites: " << constraint_clauses << std::endl;
+	SYLOG(sqlite3db_logger, 0) << "constaint composites: " << constraint_clauses << std::endl;
 
 	exec(sql);
 }
@@ -89,35 +313,213 @@ void SQLite3DB::insert(const std::string_view table_name,
 			return p.first;
 		})
 		+ ") VALUES("
-		+ helper::interleave(column_data.begin(), column_data.end(), ",", [](const auto& p) {
-			return p.second;
-		}, "\"", "\"")
+		+ helper::interleave(column_data.begin(), column_data.end(), ",", [](const auto&) {
+			return std::string("?");
+		})
 		+ ");";
 
-	exec(sql);
+	Statement stmt = prepare(sql);
+	int index = 0;
+	for (const auto& [column, value] : column_data)
+		stmt.bind(++index, value);
+	stmt.run();
+}
+
+void SQLite3DB::insert(std::string_view table_name, const std::vector<std::string>& columns,
+		const std::vector<std::vector<std::string> >& rows, std::size_t rows_per_statement) {
+	for (const auto& row : rows)
+		if (row.size() != columns.size()) throw std::invalid_argument("row size does not match columns");
+	insert_rows(table_name, columns, rows.size(), rows_per_statement, [&](std::size_t row, std::size_t col) {
+		return std::string_view(rows[row][col]);
+	});
+}
+
+void SQLite3DB::insert(std::string_view table_name, const std::vector<std::string>& columns,
+		std::span<const std::string_view> values, std::size_t rows_per_statement) {
+	if (columns.empty() || values.size() % columns.size() != 0)
+		throw std::invalid_argument("value count does not match columns");
+	insert_rows(table_name, columns, values.size() / columns.size(), rows_per_statement, [&](std::size_t row, std::size_t col) {
+		return values[row * columns.size() + col];
+	});
+}
+
+void SQLite3DB::upsert(std::string_view table_name, const std::vector<std::string>& conflict_columns,
+		const std::vector<std::pair<std::string, std::string> >& column_data) {
+	std::vector<std::string> columns;
+	for (const auto& [column, value] : column_data)
+		columns.push_back(column);
+	insert_rows(table_name, columns, 1, 1, [&](std::size_t, std::size_t col) {
+		return std::string_view(column_data[col].second);
+	}, upsert_clause(columns, conflict_columns));
+}
+
+void SQLite3DB::upsert(std::string_view table_name, const std::vector<std::string>& conflict_columns,
+		const std::vector<std::string>& columns, const std::vector<std::vector<std::string> >& rows,
+		std::size_t rows_per_statement) {
+	for (const auto& row : rows)
+		if (row.size() != columns.size()) throw std::invalid_argument("row size does not match columns");
+	insert_rows(table_name, columns, rows.size(), rows_per_statement, [&](std::size_t row, std::size_t col) {
+		return std::string_view(rows[row][col]);
+	}, upsert_clause(columns, conflict_columns));
+}
+
+template<typename ValueAt>
+void SQLite3DB::insert_rows(std::string_view table_name, const std::vector<std::string>& columns,
+		std::size_t row_count, std::size_t rows_per_statement, ValueAt value_at,
+		const std::string& conflict_clause) {
+	if (columns.empty()) throw std::invalid_argument("insert without columns");
+	if (row_count == 0) return;
+	const std::size_t max_params = sqlite3_limit(m_db.get(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+	const std::size_t rows_per_pack = std::clamp<std::size_t>(
+		std::min(rows_per_statement, max_params / columns.size()), 1, row_count);
+
+	std::optional<Transaction> transaction; // a single statement is atomic on its own
+	if (row_count > rows_per_pack && sqlite3_get_autocommit(m_db.get())) transaction.emplace(*this);
+
+	auto insert_packs = [&](std::size_t first_row, std::size_t pack_count, std::size_t pack_size) {
+		Statement stmt = prepare(insert_sql(table_name, columns, pack_size, conflict_clause));
+		for (std::size_t row = first_row; pack_count--;) {
+			int index = 0;
+			for (const std::size_t pack_end = row + pack_size; row < pack_end; ++row)
+				for (std::size_t col = 0; col < columns.size(); ++col)
+					stmt.bind(++index, value_at(row, col));
+			stmt.run();
+		}
+	};
+
+	const std::size_t full_packs = row_count / rows_per_pack;
+	insert_packs(0, full_packs, rows_per_pack);
+	if (const std::size_t rest = row_count % rows_per_pack)
+		insert_packs(full_packs * rows_per_pack, 1, rest);
+	if (transaction) transaction->commit();
+}
+
+std::string SQLite3DB::insert_sql(std::string_view table_name, const std::vector<std::string>& columns,
+		std::size_t row_count, const std::string& conflict_clause) {
+	const std::string row_sql = "("
+		+ helper::interleave(columns.begin(), columns.end(), ",", [](const std::string&) {
+			return std::string("?");
+		}) + ")";
+
+	std::string sql("INSERT INTO ");
+	sql += table_name;
+	sql += " (" + helper::interleave(columns.begin(), columns.end(), ",") + ") VALUES";
+	for (std::size_t row = 0; row < row_count; ++row)
+		sql += (row ? "," : "") + row_sql;
+	sql += conflict_clause + ";";
+	return sql;
+}
+
+std::string SQLite3DB::upsert_clause(const std::vector<std::string>& columns,
+		const std::vector<std::string>& conflict_columns) {
+	if (conflict_columns.empty()) throw std::invalid_argument("upsert without conflict columns");
+	std::vector<std::string> update_columns;
+	std::copy_if(columns.begin(), columns.end(), std::back_inserter(update_columns), [&](const std::string& column) {
+		return std::find(conflict_columns.begin(), conflict_columns.end(), column) == conflict_columns.end();
+	});
+
+	std::string sql = " ON CONFLICT(" + helper::interleave(conflict_columns.begin(), conflict_columns.end(), ",") + ") ";
+	if (update_columns.empty()) return sql + "DO NOTHING";
+	return sql + "DO UPDATE SET "
+		+ helper::interleave(update_columns.begin(), update_columns.end(), ", ", [](const std::string& column) {
+			return column + " = excluded." + column;
+		});
 }
 
 void SQLite3DB::update(std::string_view table_name,
-		const std::vector<std::pair<std::string, std::string> > new_column_data,
-		const std::vector<std::pair<std::string, std::string> > column_data_conditions) {
+		const std::vector<std::pair<std::string, std::string> >& new_column_data,
+		const std::vector<std::pair<std::string, std::string> >& column_data_conditions) {
 	std::string sql("UPDATE ");
 	sql += table_name;
 	sql += " SET "
 		+ helper::interleave(new_column_data.begin(), new_column_data.end(), ", ", [](const auto& p) {
-			return p.first + " = \"" + p.second + "\"";
+			return p.first + " = ?";
 		})
 		+ " WHERE "
 		+ helper::interleave(column_data_conditions.begin(), column_data_conditions.end(), " AND ", [](const auto& p) {
-			return p.first + " = \"" + p.second + "\"";
+			return p.first + " = ?";
 		}) + ";";
 
-	exec(sql);
+	Statement stmt = prepare(sql);
+	int index = 0;
+	for (const auto& [column, value] : new_column_data)
+		stmt.bind(++index, value);
+	for (const auto& [column, value] : column_data_conditions)
+		stmt.bind(++index, value);
+	stmt.run();
+}
+
+void SQLite3DB::update(std::string_view table_name, const std::vector<std::string>& value_columns,
+		const std::vector<std::string>& key_columns, const std::vector<std::vector<std::string> >& rows) {
+	if (value_columns.empty()) throw std::invalid_argument("update without value columns");
+	if (key_columns.empty()) throw std::invalid_argument("update without key columns");
+	for (const auto& row : rows)
+		if (row.size() != value_columns.size() + key_columns.size())
+			throw std::invalid_argument("row size does not match columns");
+	if (rows.empty()) return;
+
+	std::string sql("UPDATE ");
+	sql += table_name;
+	sql += " SET "
+		+ helper::interleave(value_columns.begin(), value_columns.end(), ", ", [](const std::string& column) {
+			return column + " = ?";
+		})
+		+ " WHERE "
+		+ helper::interleave(key_columns.begin(), key_columns.end(), " AND ", [](const std::string& column) {
+			return column + " = ?";
+		})
+		+ ";";
+
+	std::optional<Transaction> transaction;
+	if (rows.size() > 1 && sqlite3_get_autocommit(m_db.get())) transaction.emplace(*this);
+
+	Statement stmt = prepare(sql);
+	for (const auto& row : rows) {
+		int index = 0;
+		for (const std::string& value : row)
+			stmt.bind(++index, value);
+		stmt.run();
+	}
+	if (transaction) transaction->commit();
+}
+
+void SQLite3DB::remove(std::string_view table_name,
+		const std::vector<std::pair<std::string, std::string> >& column_data_conditions) {
+	std::string sql("DELETE FROM ");
+	sql += table_name;
+	sql += " WHERE "
+		+ helper::interleave(column_data_conditions.begin(), column_data_conditions.end(), " AND ", [](const auto& p) {
+			return p.first + " = ?";
+		}) + ";";
+
+	Statement stmt = prepare(sql);
+	int index = 0;
+	for (const auto& [column, value] : column_data_conditions)
+		stmt.bind(++index, value);
+	stmt.run();
 }
 
 SQLite3DB::Column SQLite3DB::default_key(const std::string& name) {
 	return {name, DataType::INT, false, true, KeyType::PRIMARY};
 }
 
+std::string SQLite3DB::to_sql(JournalMode journal_mode) {
+	switch (journal_mode) {
+		case JournalMode::TRUNCATE:
+			return "TRUNCATE";
+		case JournalMode::PERSIST:
+			return "PERSIST";
+		case JournalMode::MEMORY:
+			return "MEMORY";
+		case JournalMode::WAL:
+			return "WAL";
+		case JournalMode::OFF:
+			return "OFF";
+		default:
+			throw std::runtime_error("invalid JournalMode");
+	}
+}
+
 std::string SQLite3DB::to_sql(DataType data_type) {
 	switch (data_type) {
 		case DataType::INT:
@@ -132,7 +534,7 @@ std::string SQLite3DB::to_sql(DataType data_type) {
 }
 
 void SQLite3DB::exec(const std::string& sql) {
-	sqlite3db_logger(0) << "exec(\"" << sql << "\") ..." << std::endl;
+	SYLOG(sqlite3db_logger, 0) << "exec(\"" << sql << "\") ..." << std::endl;
 	if (char* sql_err = nullptr; sqlite3_exec(m_db.get(), sql.c_str(), nullptr, nullptr, &sql_err) != SQLITE_OK) {
 		const std::string err_msg(sql_err);
 		sqlite3_free(sql_err);
@@ -140,13 +542,254 @@ void SQLite3DB::exec(const std::string& sql) {
 	}
 }
 
-SQLite3DB::Transaction::Transaction(SQLite3DB& db) : m_db(db) {
+SQLite3DB::Statement SQLite3DB::prepare(std::string_view sql) {
+	return Statement(*this, sql);
+}
+
+void SQLite3DB::sqlite3_stmtDeleter::operator()(sqlite3_stmt* stmt) const {
+	sqlite3_finalize(stmt);
+}
+
+std::size_t SQLite3DB::StatementHash::operator()(std::string_view sql) const {
+	return std::hash<std::string_view> { }(sql);
+}
+
+SQLite3DB::Statement::Statement(SQLite3DB& db, std::string_view sql, bool cached) : m_db(db), m_cached(cached) {
+	if (auto it = m_db.m_statements.find(sql); m_cached && it != m_db.m_statements.end()) {
+		m_node = m_db.m_statements.extract(it);
+		return;
+	}
+
+	SYLOG(sqlite3db_logger, 0) << "prepare(\"" << sql << "\") ..." << std::endl;
+	sqlite3_stmt* stmt = nullptr;
+	if (sqlite3_prepare_v3(m_db.m_db.get(), sql.data(), sql.size(), m_cached ? SQLITE_PREPARE_PERSISTENT : 0, &stmt, nullptr)
+			!= SQLITE_OK)
+		throw std::runtime_error(sqlite3_errmsg(m_db.m_db.get()));
+	// cache entries are moved in and out as nodes, so checking out a cached statement does not allocate
+	StatementCache fresh;
+	fresh.emplace(std::string(sql), CachedStatement { std::unique_ptr<sqlite3_stmt, sqlite3_stmtDeleter>(stmt) });
+	m_node = fresh.extract(fresh.begin());
+}
+
+SQLite3DB::Statement::~Statement() {
+	if (!m_cached) return; // finalized with m_node
+	sqlite3_reset(m_node.mapped().get());
+	sqlite3_clear_bindings(m_node.mapped().get());
+	m_node.mapped().last_use = ++m_db.m_statement_uses;
+	m_db.m_statements.insert(std::move(m_node)); // finalized instead if the same SQL was checked out twice
+	if (m_db.m_statements.size() > m_db.m_statement_cache_size)
+		m_db.m_statements.erase(std::min_element(m_db.m_statements.begin(), m_db.m_statements.end(),
+			[](const auto& a, const auto& b) {
+				return a.second.last_use < b.second.last_use;
+			}));
+}
+
+void SQLite3DB::Statement::bind(int index, std::string_view value) {
+	// an empty view may have no data pointer, which SQLite would bind as NULL
+	if (sqlite3_bind_text(m_node.mapped().get(), index, value.data() ? value.data() : "", value.size(), SQLITE_STATIC) != SQLITE_OK)
+		throw std::runtime_error(sqlite3_errmsg(m_db.m_db.get()));
+}
+
+void SQLite3DB::Statement::bind(int index, std::int64_t value) {
+	if (sqlite3_bind_int64(m_node.mapped().get(), index, value) != SQLITE_OK)
+		throw std::runtime_error(sqlite3_errmsg(m_db.m_db.get()));
+}
+
+void SQLite3DB::Statement::bind(int index, double value) {
+	if (sqlite3_bind_double(m_node.mapped().get(), index, value) != SQLITE_OK)
+		throw std::runtime_error(sqlite3_errmsg(m_db.m_db.get()));
+}
+
+void SQLite3DB::Statement::bind_null(int index) {
+	if (sqlite3_bind_null(m_node.mapped().get(), index) != SQLITE_OK)
+		throw std::runtime_error(sqlite3_errmsg(m_db.m_db.get()));
+}
+
+bool SQLite3DB::Statement::step() {
+	sqlite3_stmt* stmt = m_node.mapped().get();
+	switch (sqlite3_step(stmt)) {
+		case SQLITE_ROW:
+			return true;
+		case SQLITE_DONE:
+			return false;
+		default: {
+			const std::string err_msg(sqlite3_errmsg(m_db.m_db.get()));
+			sqlite3_reset(stmt);
+			throw std::runtime_error(err_msg);
+		}
+	}
+}
+
+void SQLite3DB::Statement::run() {
+	sqlite3_stmt* stmt = m_node.mapped().get();
+	SYLOG(sqlite3db_logger, 0) << "run(\"" << sqlite3_sql(stmt) << "\") ..." << std::endl;
+	while (step());
+	sqlite3_reset(stmt);
+}
+
+sqlite3_stmt* SQLite3DB::Statement::get() const {
+	return m_node.mapped().get();
+}
+
+SQLite3DB::Row::Row(sqlite3_stmt* stmt) : m_stmt(stmt) {
+}
+
+int SQLite3DB::Row::size() const {
+	return sqlite3_column_count(m_stmt);
+}
+
+bool SQLite3DB::Row::is_null(int column) const {
+	return sqlite3_column_type(m_stmt, column) == SQLITE_NULL;
+}
+
+std::string_view SQLite3DB::Row::text(int column) const {
+	// text must be fetched before its size, the conversion may change the byte count
+	const auto* text = reinterpret_cast<const char*>(sqlite3_column_text(m_stmt, column));
+	return text ? std::string_view(text, sqlite3_column_bytes(m_stmt, column)) : std::string_view();
+}
+
+std::int64_t SQLite3DB::Row::integer(int column) const {
+	return sqlite3_column_int64(m_stmt, column);
+}
+
+double SQLite3DB::Row::real(int column) const {
+	return sqlite3_column_double(m_stmt, column);
+}
+
+SQLite3DB::Query::Query(SQLite3DB& db, const std::string& sql, std::vector<std::string> parameters) :
+		m_parameters(std::move(parameters)), m_stmt(db, sql) {
+	int index = 0;
+	for (const std::string& parameter : m_parameters)
+		m_stmt.bind(++index, parameter);
+}
+
+bool SQLite3DB::Query::next() {
+	if (m_started && !m_has_row) return false;
+	if (!m_started) {
+		SYLOG(sqlite3db_logger, 0) << "query(\"" << sqlite3_sql(m_stmt.get()) << "\") ..." << std::endl;
+	}
+	m_started = true;
+	return m_has_row = m_stmt.step();
+}
+
+SQLite3DB::Row SQLite3DB::Query::row() const {
+	if (!m_has_row) throw std::runtime_error("no current row");
+	return Row(m_stmt.get());
+}
+
+SQLite3DB::Query::iterator SQLite3DB::Query::begin() {
+	if (!m_started) next();
+	return iterator(this);
+}
+
+std::default_sentinel_t SQLite3DB::Query::end() const {
+	return std::default_sentinel;
+}
+
+SQLite3DB::Query::iterator::iterator(Query* query) : m_query(query) {
+}
+
+SQLite3DB::Row SQLite3DB::Query::iterator::operator*() const {
+	return m_query->row();
+}
+
+SQLite3DB::Query::iterator& SQLite3DB::Query::iterator::operator++() {
+	m_query->next();
+	return *this;
+}
+
+void SQLite3DB::Query::iterator::operator++(int) {
+	++*this;
+}
+
+bool SQLite3DB::Query::iterator::operator==(std::default_sentinel_t) const {
+	return !m_query || !m_query->m_has_row;
+}
+
+SQLite3DB::Query SQLite3DB::query(const std::string& sql, std::vector<std::string> parameters) {
+	if (m_verify_query_plans) assert_indexed(sql);
+	return Query(*this, sql, std::move(parameters));
+}
+
+SQLite3DB::Index::Index(const std::string& name, const std::string& table_name, const std::vector<std::string>& columns,
+		bool unique, const std::string& where, const std::vector<std::string>& covering_columns) :
+		name(name), table_name(table_name), columns(columns), unique(unique), where(where), covering_columns(covering_columns) {
+	if (columns.empty()) throw std::runtime_error("index without columns");
+	if (unique && !covering_columns.empty()) throw std::runtime_error("covering columns would be part of the unique key");
+}
+
+std::string SQLite3DB::Index::to_sql() const {
+	std::vector<std::string> all_columns(columns);
+	all_columns.insert(all_columns.end(), covering_columns.begin(), covering_columns.end());
+	return std::string("CREATE ") + (unique ? "UNIQUE " : "") + "INDEX " + name
+		+ " ON " + table_name + "(" + helper::interleave(all_columns.begin(), all_columns.end(), ",") + ")"
+		+ (where.empty() ? "" : " WHERE " + where) + ";";
+}
+
+void SQLite3DB::create_index(const Index& index) {
+	exec(index.to_sql());
+}
+
+std::vector<SQLite3DB::QueryPlanStep> SQLite3DB::explain(const std::string& sql) {
+	std::vector<QueryPlanStep> plan;
+	std::set<std::string, std::less<> > derived; // names of materialized subqueries and CTEs
+	Statement stmt(*this, "EXPLAIN QUERY PLAN " + sql, false); // one-off, kept out of the statement cache
+	while (stmt.step()) {
+		const Row row(stmt.get());
+		const std::string_view detail = row.text(3);
+		for (const std::string_view step : { "MATERIALIZE ", "CO-ROUTINE " })
+			if (detail.starts_with(step)) derived.emplace(detail.substr(step.size()));
+		plan.push_back( { static_cast<int>(row.integer(0)), static_cast<int>(row.integer(1)), std::string(detail), false });
+	}
+	for (QueryPlanStep& step : plan) {
+		if (!step.detail.starts_with("SCAN ") || step.detail.find(" USING ") != std::string::npos
+				|| step.detail == "SCAN CONSTANT ROW")
+			continue;
+		const std::string_view scanned = std::string_view(step.detail).substr(5, step.detail.find(' ', 5) - 5);
+		step.full_scan = !scanned.starts_with('(') && !derived.contains(scanned); // "(subquery-1)", "(join-2)"
+	}
+	return plan;
+}
+
+void SQLite3DB::assert_indexed(const std::string& sql) {
+	for (const QueryPlanStep& step : explain(sql))
+		if (step.full_scan) {
+			SYLOG(sqlite3db_logger, 2) << "full table scan (" << step.detail << ") in: " << sql << std::endl;
+			throw std::runtime_error("full table scan in query plan: " + step.detail);
+		}
+}
+
+void SQLite3DB::verify_query_plans(bool enable) {
+	m_verify_query_plans = enable;
+}
+
+SQLite3DB::Transaction::Transaction(SQLite3DB& db) :
+		m_db(db), m_uncaught_exceptions(std::uncaught_exceptions()) {
 	m_db.exec("BEGIN");
 }
 
 SQLite3DB::Transaction::~Transaction() {
-	// Must end SQLite transaction even on query error <- guaranteed on exception by RAII
-	m_db.exec("COMMIT");
+	if (!m_open) return;
+	if (std::uncaught_exceptions() > m_uncaught_exceptions) {
+		// may fail if SQLite already rolled back on the error, nothing left to do then
+		sqlite3_exec(m_db.m_db.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+		return;
+	}
+	try {
+		commit();
+	} catch (const std::exception& e) {
+		SYLOG(sqlite3db_logger, 2) << "transaction rolled back: " << e.what() << std::endl;
+	}
+}
+
+void SQLite3DB::Transaction::commit() {
+	m_open = false;
+	try {
+		m_db.exec("COMMIT");
+	} catch (...) {
+		sqlite3_exec(m_db.m_db.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+		throw;
+	}
 }
 
 SQLite3DB::Transaction SQLite3DB::start_transaction() {
@@ -0,0 +1,81 @@
+#include <stdexcept>
+
+#include <SQLite3DBPool.hh>
+
+namespace shimiyuu {
+
+static SQLite3DB::Options writer_options(SQLite3DB::Options options) {
+	options.read_only = false;
+	options.journal_mode = SQLite3DB::JournalMode::WAL; // persistent: readers opened afterwards are in WAL mode as well
+	if (!options.busy_timeout_ms) options.busy_timeout_ms = 5000;
+	return options;
+}
+
+SQLite3DBPool::SQLite3DBPool(const std::string& database_file, std::size_t reader_count, SQLite3DB::Options options) :
+		m_writer(database_file, writer_options(options)) {
+	if (reader_count == 0) throw std::invalid_argument("pool needs at least one reader");
+
+	options = writer_options(options);
+	options.read_only = true;
+	options.journal_mode = SQLite3DB::JournalMode::DEFAULT;
+	for (std::size_t i = 0; i < reader_count; ++i)
+		m_idle_readers.push_back(m_readers.emplace_back(std::make_unique<SQLite3DB>(database_file, options)).get());
+	SYLOG(sqlite3db_logger, 1) << "opened pool on " << database_file << " with " << reader_count << " readers" << std::endl;
+}
+
+SQLite3DBPool::WriterLease SQLite3DBPool::writer() {
+	return WriterLease(m_writer_mtx, m_writer);
+}
+
+SQLite3DBPool::ReaderLease SQLite3DBPool::reader() {
+	std::unique_lock lock { m_readers_mtx };
+	m_reader_returned.wait(lock, [this] {
+		return !m_idle_readers.empty();
+	});
+	SQLite3DB* reader = m_idle_readers.back();
+	m_idle_readers.pop_back();
+	return ReaderLease(*this, *reader);
+}
+
+void SQLite3DBPool::release(SQLite3DB* reader) {
+	{
+		std::scoped_lock lock { m_readers_mtx };
+		m_idle_readers.push_back(reader);
+	}
+	m_reader_returned.notify_one();
+}
+
+SQLite3DBPool::WriterLease::WriterLease(std::mutex& mtx, SQLite3DB& db) :
+		m_lock(mtx), m_db(&db) {
+}
+
+SQLite3DB& SQLite3DBPool::WriterLease::operator*() const {
+	return *m_db;
+}
+
+SQLite3DB* SQLite3DBPool::WriterLease::operator->() const {
+	return m_db;
+}
+
+SQLite3DBPool::ReaderLease::ReaderLease(SQLite3DBPool& pool, SQLite3DB& db) :
+		m_pool(&pool), m_db(&db) {
+}
+
+SQLite3DBPool::ReaderLease::~ReaderLease() {
+	if (m_db) m_pool->release(m_db);
+}
+
+SQLite3DBPool::ReaderLease::ReaderLease(ReaderLease&& other) noexcept :
+		m_pool(other.m_pool), m_db(other.m_db) {
+	other.m_db = nullptr;
+}
+
+SQLite3DB& SQLite3DBPool::ReaderLease::operator*() const {
+	return *m_db;
+}
+
+SQLite3DB* SQLite3DBPool::ReaderLease::operator->() const {
+	return m_db;
+}
+
+}
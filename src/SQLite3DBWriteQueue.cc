@@ -0,0 +1,123 @@
+#include <SQLite3DBWriteQueue.hh>
+
+namespace shimiyuu {
+
+SQLite3DBWriteQueue::SQLite3DBWriteQueue(SQLite3DB& db, std::size_t max_rows, std::chrono::milliseconds max_delay) :
+		m_db(db), m_max_rows(max_rows), m_max_delay(max_delay), m_writer([this] {
+			run();
+		}) {
+}
+
+SQLite3DBWriteQueue::~SQLite3DBWriteQueue() {
+	{
+		std::scoped_lock lock { m_mtx };
+		m_stop = true;
+	}
+	m_work_available.notify_one();
+	m_writer.join();
+}
+
+void SQLite3DBWriteQueue::insert(std::string_view table_name,
+		std::vector<std::pair<std::string, std::string> > column_data) {
+	enqueue( { std::string(table_name), std::move(column_data), { }, false });
+}
+
+void SQLite3DBWriteQueue::update(std::string_view table_name,
+		std::vector<std::pair<std::string, std::string> > new_column_data,
+		std::vector<std::pair<std::string, std::string> > column_data_conditions) {
+	enqueue( { std::string(table_name), std::move(new_column_data), std::move(column_data_conditions), true });
+}
+
+void SQLite3DBWriteQueue::enqueue(Operation op) {
+	{
+		std::scoped_lock lock { m_mtx };
+		m_pending.push_back(std::move(op));
+		++m_enqueued;
+	}
+	m_work_available.notify_one();
+}
+
+void SQLite3DBWriteQueue::flush() {
+	std::unique_lock lock { m_mtx };
+	const std::uint64_t target = m_enqueued;
+	m_flush_target = std::max(m_flush_target, target);
+	m_work_available.notify_one();
+	m_committed.wait(lock, [&] {
+		return m_durable >= target;
+	});
+	if (m_error) std::rethrow_exception(std::exchange(m_error, nullptr));
+}
+
+void SQLite3DBWriteQueue::run() {
+	using clock = std::chrono::steady_clock;
+
+	std::deque<Operation> batch;
+	std::uint64_t applied = 0; // sequence number of the last applied operation
+	std::size_t uncommitted = 0;
+	clock::time_point commit_deadline;
+
+	std::exception_ptr error;
+	auto exec = [&](const std::string& sql) {
+		try {
+			m_db.exec(sql);
+		} catch (...) {
+			if (!error) error = std::current_exception();
+			if (sql == "COMMIT" && !sqlite3_get_autocommit(m_db.m_db.get()))
+				sqlite3_exec(m_db.m_db.get(), "ROLLBACK", nullptr, nullptr, nullptr);
+		}
+	};
+
+	std::unique_lock lock { m_mtx };
+	while (true) {
+		auto work_ready = [&] {
+			return m_stop || !m_pending.empty() || (uncommitted && m_flush_target > m_durable);
+		};
+		if (uncommitted)
+			m_work_available.wait_until(lock, commit_deadline, work_ready);
+		else
+			m_work_available.wait(lock, work_ready);
+
+		batch.swap(m_pending);
+		lock.unlock();
+
+		for (const Operation& op : batch) {
+			if (!uncommitted) {
+				exec("BEGIN");
+				commit_deadline = clock::now() + m_max_delay;
+			}
+			try {
+				if (op.update)
+					m_db.update(op.table_name, op.column_data, op.column_data_conditions);
+				else
+					m_db.insert(op.table_name, op.column_data);
+			} catch (...) {
+				if (!error) error = std::current_exception();
+			}
+			++applied;
+			++uncommitted;
+			if (uncommitted >= m_max_rows) {
+				exec("COMMIT");
+				uncommitted = 0;
+			}
+		}
+		batch.clear();
+
+		lock.lock();
+		if (uncommitted && (m_stop || m_flush_target > m_durable || clock::now() >= commit_deadline)) {
+			lock.unlock();
+			exec("COMMIT");
+			lock.lock();
+			uncommitted = 0;
+		}
+		if (error && !m_error) m_error = error;
+		error = nullptr;
+		if (!uncommitted && m_durable != applied) {
+			SYLOG(sqlite3db_logger, 0) << "write queue committed up to #" << applied << std::endl;
+			m_durable = applied;
+			m_committed.notify_all();
+		}
+		if (m_stop && m_pending.empty() && !uncommitted) break;
+	}
+}
+
+}
@@ -10,10 +10,43 @@
 namespace shimiyuu::helper {
 
 std::string timestamp() {
+	char buffer[timestamp_length];
+	return std::string(timestamp(buffer));
+}
+
+std::string_view timestamp(std::span<char, timestamp_length> buffer) {
+	thread_local std::time_t cached_second = -1;
+	thread_local char cached_hms[8]; // HH:MM:SS of cached_second
+
+	const auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+	const auto second = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+	const int ms = std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch - second).count();
+	if (second.count() != cached_second) {
+		cached_second = second.count();
+		std::tm now_tm;
+		localtime_r(&cached_second, &now_tm); // std::localtime shares its result between threads
+		const int fields[] { now_tm.tm_hour, now_tm.tm_min, now_tm.tm_sec };
+		for (int i = 0; i < 3; ++i) {
+			cached_hms[i * 3] = '0' + fields[i] / 10;
+			cached_hms[i * 3 + 1] = '0' + fields[i] % 10;
+			if (i < 2) cached_hms[i * 3 + 2] = ':';
+		}
+	}
+
+	std::copy(std::begin(cached_hms), std::end(cached_hms), buffer.begin());
+	buffer[8] = '.';
+	buffer[9] = '0' + ms / 100;
+	buffer[10] = '0' + ms / 10 % 10;
+	buffer[11] = '0' + ms % 10;
+	return { buffer.data(), buffer.size() };
+}
+
+std::string timestamp_uncached() {
 	const auto now = std::chrono::system_clock::now();
 	const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
 	const auto now_t = std::chrono::system_clock::to_time_t(now);
-	const std::tm now_tm = *std::localtime(&now_t);
+	std::tm now_tm;
+	localtime_r(&now_t, &now_tm);
 	std::ostringstream oss;
 	oss << std::put_time(&now_tm, "%H:%M:%S") << '.' << std::setfill('0') << std::setw(3) << ms.count();
 	return oss.str();
@@ -1,18 +1,50 @@
 #include <stdexcept>
 #include <map>
+#include <cerrno>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <helper.hh>
 
 #include <network/curl.hh>
+#include <network/curl_share.hh>
 
 namespace shimiyuu::network {
 
 Curl::Curl() {
 	Global::init();
 	m_handle = curl_easy_init();
+	set_defaults();
+}
+
+Curl::Curl(CurlShare& share) :
+		Curl() {
+	m_share = &share;
+	curl_easy_setopt(m_handle, CURLOPT_SHARE, m_share->m_share);
+}
+
+void Curl::set_defaults() {
 	curl_easy_setopt(m_handle, CURLOPT_COOKIEFILE, "");
 	curl_easy_setopt(m_handle, CURLOPT_FOLLOWLOCATION, 1L);
 	curl_easy_setopt(m_handle, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:82.0) Gecko/20100101 Firefox/82.0");
 }
 
+void Curl::reset() {
+	reset_headers();
+	curl_easy_reset(m_handle);
+	set_defaults();
+	if (m_share) curl_easy_setopt(m_handle, CURLOPT_SHARE, m_share->m_share);
+	m_metrics = nullptr; // the aggregate of a previous user may be gone
+	m_resume = false;
+	m_last_metrics = { };
+}
+
 Curl::~Curl() {
 	reset_headers();
 	curl_easy_cleanup(m_handle);
@@ -38,26 +70,152 @@ void Curl::set_headers(const std::vector<std::string>& headers) {
 	curl_easy_setopt(m_handle, CURLOPT_HTTPHEADER, m_current_headers);
 }
 
+CURL* Curl::duplicate(curl_slist*& headers) const {
+	// a duplicated handle points to the same header list, which set_headers(..) may free
+	headers = nullptr;
+	for (const curl_slist* header = m_current_headers; header; header = header->next)
+		headers = curl_slist_append(headers, header->data);
+	CURL* handle = curl_easy_duphandle(m_handle);
+	if (!handle) {
+		curl_slist_free_all(headers);
+		throw std::runtime_error("failed curl_easy_duphandle");
+	}
+	curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+	if (m_share) curl_easy_setopt(handle, CURLOPT_SHARE, m_share->m_share); // not duplicated
+	return handle;
+}
+
+void Curl::set_compression(bool enable) const {
+	curl_easy_setopt(m_handle, CURLOPT_ACCEPT_ENCODING, enable ? "" : nullptr); // "": every encoding libcurl was built with
+}
+
+void Curl::set_http2(bool enable, bool prior_knowledge) const {
+	const long version = !enable ? CURL_HTTP_VERSION_1_1
+		: prior_knowledge ? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_2TLS;
+	curl_easy_setopt(m_handle, CURLOPT_HTTP_VERSION, version);
+	curl_easy_setopt(m_handle, CURLOPT_PIPEWAIT, enable ? 1L : 0L);
+}
+
 std::string Curl::get_string(const std::string& url) const {
 	std::string buf;
 	curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, &buf);
 	curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, write_string);
 	curl_easy_setopt(m_handle, CURLOPT_URL, url.c_str());
-	if (curl_easy_perform(m_handle)) throw std::runtime_error("failed GET string");
+	const CURLcode result = curl_easy_perform(m_handle);
+	collect_metrics(result);
+	if (result) throw std::runtime_error("failed GET string");
 	return buf;
 }
 
+Curl::Response Curl::get(const std::string& url, const std::vector<std::string>& extra_headers) const {
+	curl_slist* headers = nullptr;
+	for (const curl_slist* header = m_current_headers; header; header = header->next)
+		headers = curl_slist_append(headers, header->data);
+	for (const std::string& header : extra_headers)
+		headers = curl_slist_append(headers, header.c_str());
+
+	Response response { 0, { }, { } };
+	curl_easy_setopt(m_handle, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(m_handle, CURLOPT_HEADERDATA, &response.headers);
+	curl_easy_setopt(m_handle, CURLOPT_HEADERFUNCTION, write_header);
+	curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, &response.body);
+	curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, write_string);
+	curl_easy_setopt(m_handle, CURLOPT_URL, url.c_str());
+	const CURLcode result = curl_easy_perform(m_handle);
+	collect_metrics(result);
+	curl_easy_setopt(m_handle, CURLOPT_HTTPHEADER, m_current_headers);
+	curl_easy_setopt(m_handle, CURLOPT_HEADERFUNCTION, nullptr);
+	curl_easy_setopt(m_handle, CURLOPT_HEADERDATA, nullptr);
+	curl_slist_free_all(headers);
+	if (result) throw std::runtime_error("failed GET");
+	curl_easy_getinfo(m_handle, CURLINFO_RESPONSE_CODE, &response.status);
+	return response;
+}
+
 std::string Curl::post(const std::string& url, const std::map<std::string, std::string>& data) const {
-	std::string post_data, buf;
-	for (const auto& [key, val] : data)
-		post_data += (post_data.empty() ? "" : "&") + key + "=" + val;
+	const std::string post_data = form_encode(data);
+	std::string buf;
 	curl_easy_setopt(m_handle, CURLOPT_POSTFIELDS, post_data.c_str());
 	curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, &buf);
 	curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, write_string);
 	curl_easy_setopt(m_handle, CURLOPT_URL, url.c_str());
-	const bool error = curl_easy_perform(m_handle);
+	const CURLcode result = curl_easy_perform(m_handle);
+	collect_metrics(result);
 	curl_easy_setopt(m_handle, CURLOPT_HTTPGET, 1L);
-	if (error) throw std::runtime_error("failed POST");
+	if (result) throw std::runtime_error("failed POST");
+	return buf;
+}
+
+std::string Curl::post_multipart(const std::string& url, const std::vector<Part>& parts) const {
+	curl_mime* mime = curl_mime_init(m_handle);
+	for (const Part& part : parts) {
+		curl_mimepart* mime_part = curl_mime_addpart(mime);
+		curl_mime_name(mime_part, part.name.c_str());
+		if (!part.path.empty()) {
+			if (curl_mime_filedata(mime_part, part.path.c_str())) {
+				curl_mime_free(mime);
+				throw std::runtime_error("failed to read " + part.path.string());
+			}
+		} else if (part.source)
+			curl_mime_data_cb(mime_part, part.size, read_from_source, nullptr, nullptr, const_cast<BodySource*>(&part.source));
+		else
+			curl_mime_data(mime_part, part.value.data(), part.value.size());
+		if (!part.filename.empty()) curl_mime_filename(mime_part, part.filename.c_str());
+		if (!part.content_type.empty()) curl_mime_type(mime_part, part.content_type.c_str());
+	}
+
+	std::string buf;
+	curl_easy_setopt(m_handle, CURLOPT_MIMEPOST, mime);
+	curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, &buf);
+	curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, write_string);
+	curl_easy_setopt(m_handle, CURLOPT_URL, url.c_str());
+	const CURLcode result = curl_easy_perform(m_handle);
+	collect_metrics(result);
+	curl_easy_setopt(m_handle, CURLOPT_MIMEPOST, nullptr);
+	curl_easy_setopt(m_handle, CURLOPT_HTTPGET, 1L);
+	curl_mime_free(mime);
+	if (result) throw std::runtime_error("failed multipart POST");
+	return buf;
+}
+
+std::string Curl::upload(const std::string& url, const std::filesystem::path& file, const std::string& content_type) const {
+	std::ifstream ifs(file, std::ios::binary);
+	if (!ifs) throw std::runtime_error("failed to open " + file.string());
+	const BodySource source = [&ifs](std::span<std::byte> buffer) {
+		ifs.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		if (ifs.bad()) throw std::runtime_error("failed to read");
+		return static_cast<std::size_t>(ifs.gcount());
+	};
+	return upload(url, source, std::filesystem::file_size(file), content_type);
+}
+
+std::string Curl::upload(const std::string& url, const BodySource& source, curl_off_t size,
+		const std::string& content_type) const {
+	curl_slist* headers = nullptr;
+	for (const curl_slist* header = m_current_headers; header; header = header->next)
+		headers = curl_slist_append(headers, header->data);
+	headers = curl_slist_append(headers, ("Content-Type: " + content_type).c_str());
+	if (size < 0) headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
+
+	std::string buf;
+	curl_easy_setopt(m_handle, CURLOPT_POST, 1L);
+	curl_easy_setopt(m_handle, CURLOPT_POSTFIELDS, nullptr); // would take precedence over the read callback
+	curl_easy_setopt(m_handle, CURLOPT_POSTFIELDSIZE_LARGE, size);
+	curl_easy_setopt(m_handle, CURLOPT_READDATA, const_cast<BodySource*>(&source));
+	curl_easy_setopt(m_handle, CURLOPT_READFUNCTION, read_from_source);
+	curl_easy_setopt(m_handle, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, &buf);
+	curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, write_string);
+	curl_easy_setopt(m_handle, CURLOPT_URL, url.c_str());
+	const CURLcode result = curl_easy_perform(m_handle);
+	collect_metrics(result);
+	curl_easy_setopt(m_handle, CURLOPT_HTTPHEADER, m_current_headers);
+	curl_easy_setopt(m_handle, CURLOPT_READFUNCTION, nullptr);
+	curl_easy_setopt(m_handle, CURLOPT_READDATA, nullptr);
+	curl_easy_setopt(m_handle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(-1));
+	curl_easy_setopt(m_handle, CURLOPT_HTTPGET, 1L);
+	curl_slist_free_all(headers);
+	if (result) throw std::runtime_error("failed upload");
 	return buf;
 }
 
@@ -65,7 +223,174 @@ void Curl::write(const std::string& url, std::ostream& os) const {
 	curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, &os);
 	curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, write_to_stream);
 	curl_easy_setopt(m_handle, CURLOPT_URL, url.c_str());
-	if (curl_easy_perform(m_handle)) throw std::runtime_error("failed GET data");
+	const CURLcode result = curl_easy_perform(m_handle);
+	collect_metrics(result);
+	if (result) throw std::runtime_error("failed GET data");
+}
+
+void Curl::stream(const std::string& url, const ChunkSink& sink) const {
+	StreamState state { *this, sink };
+	m_resume = false;
+	curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, &state);
+	curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, write_to_sink);
+	// libcurl keeps calling the progress callback while paused: the only safe place to unpause from
+	curl_easy_setopt(m_handle, CURLOPT_XFERINFODATA, &state);
+	curl_easy_setopt(m_handle, CURLOPT_XFERINFOFUNCTION, unpause_on_resume);
+	curl_easy_setopt(m_handle, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(m_handle, CURLOPT_URL, url.c_str());
+	const CURLcode result = curl_easy_perform(m_handle);
+	collect_metrics(result);
+	curl_easy_setopt(m_handle, CURLOPT_NOPROGRESS, 1L);
+	if (state.aborted) throw std::runtime_error("aborted GET stream");
+	if (result) throw std::runtime_error("failed GET stream");
+}
+
+void Curl::download(const std::string& url, const std::filesystem::path& file, unsigned segments) const {
+	const std::filesystem::path sidecar = file.string() + ".download";
+
+	std::map<std::string, std::string> headers;
+	curl_easy_setopt(m_handle, CURLOPT_NOBODY, 1L);
+	curl_easy_setopt(m_handle, CURLOPT_HEADERDATA, &headers);
+	curl_easy_setopt(m_handle, CURLOPT_HEADERFUNCTION, write_header);
+	curl_easy_setopt(m_handle, CURLOPT_URL, url.c_str());
+	const CURLcode probe = curl_easy_perform(m_handle);
+	record_metrics(m_handle, probe);
+	curl_easy_setopt(m_handle, CURLOPT_HEADERFUNCTION, nullptr);
+	curl_easy_setopt(m_handle, CURLOPT_HEADERDATA, nullptr);
+	curl_easy_setopt(m_handle, CURLOPT_HTTPGET, 1L);
+	long status = 0;
+	curl_off_t length = -1;
+	curl_easy_getinfo(m_handle, CURLINFO_RESPONSE_CODE, &status);
+	curl_easy_getinfo(m_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+
+	const auto single_get = [&] {
+		std::filesystem::remove(sidecar);
+		const FileDescriptor fd(::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+		if (fd.get() < 0) throw std::runtime_error("failed to open " + file.string());
+		stream(url, fd_sink(fd.get()));
+	};
+	if (probe || status != 200 || length <= 0 || headers["accept-ranges"] != "bytes" || segments < 2) {
+		single_get();
+		return;
+	}
+
+	const std::string validator = !headers["etag"].empty() ? headers["etag"] : headers["last-modified"];
+	// without a validator the resource may have changed, without the preallocated file the progress is void
+	std::error_code error;
+	const bool resumable = !validator.empty()
+		&& std::filesystem::file_size(file, error) == static_cast<std::uintmax_t>(length) && !error;
+	const FileDescriptor fd(::open(file.c_str(), O_RDWR | O_CREAT, 0644));
+	if (fd.get() < 0) throw std::runtime_error("failed to open " + file.string());
+
+	std::vector<Segment> parts;
+	// the sidecar must never claim bytes that are not on disk yet
+	const auto save = [&] {
+		if (::fdatasync(fd.get())) throw std::runtime_error("failed to sync " + file.string());
+		save_progress(sidecar, length, validator, parts);
+	};
+	if (!resumable || !load_progress(sidecar, length, validator, parts)) {
+		const curl_off_t segment_size = (length + segments - 1) / segments;
+		for (curl_off_t begin = 0; begin < length; begin += segment_size)
+			parts.push_back( { fd.get(), begin, std::min(begin + segment_size, length), 0 });
+		if (::ftruncate(fd.get(), length) || ::posix_fallocate(fd.get(), 0, length))
+			throw std::runtime_error("failed to allocate " + file.string());
+		save();
+	}
+
+	bool failed = false, ranges_ignored = false;
+	{
+		const SegmentTransfers transfers(parts);
+		std::vector<std::string> ranges(parts.size());
+		for (std::size_t i = 0; i < parts.size(); ++i) {
+			Segment& part = parts[i];
+			part.fd = fd.get();
+			part.length = length;
+			if (part.begin + part.done == part.end) continue;
+			ranges[i] = std::to_string(part.begin + part.done) + "-" + std::to_string(part.end - 1);
+			part.handle = curl_easy_duphandle(m_handle);
+			if (!part.handle) throw std::runtime_error("failed curl_easy_duphandle");
+			if (m_share) curl_easy_setopt(part.handle, CURLOPT_SHARE, m_share->m_share);
+			curl_easy_setopt(part.handle, CURLOPT_RANGE, ranges[i].c_str());
+			curl_easy_setopt(part.handle, CURLOPT_WRITEDATA, &part);
+			curl_easy_setopt(part.handle, CURLOPT_WRITEFUNCTION, write_to_segment);
+			curl_multi_add_handle(transfers.multi, part.handle);
+		}
+
+		auto last_save = std::chrono::steady_clock::now();
+		for (int running = 1; running;) {
+			if (curl_multi_perform(transfers.multi, &running) || curl_multi_poll(transfers.multi, nullptr, 0, 1000, nullptr)) {
+				failed = true;
+				break;
+			}
+			int queued;
+			while (const CURLMsg* msg = curl_multi_info_read(transfers.multi, &queued)) {
+				if (msg->msg != CURLMSG_DONE) continue;
+				record_metrics(msg->easy_handle, msg->data.result);
+				if (msg->data.result) failed = true;
+			}
+			if (std::chrono::steady_clock::now() - last_save > std::chrono::seconds(1)) {
+				save();
+				last_save = std::chrono::steady_clock::now();
+			}
+		}
+	}
+	for (const Segment& part : parts) {
+		if (part.begin + part.done != part.end) failed = true;
+		if (part.whole) ranges_ignored = true;
+	}
+
+	if (ranges_ignored) { // the server answered a range request with the whole resource after all
+		single_get();
+		return;
+	}
+	if (failed) {
+		save();
+		throw std::runtime_error("failed segmented GET of " + url);
+	}
+	std::filesystem::remove(sidecar);
+}
+
+void Curl::resume() const {
+	m_resume = true;
+}
+
+Curl::FileDescriptor::FileDescriptor(int fd) : m_fd(fd) {
+}
+
+Curl::FileDescriptor::~FileDescriptor() {
+	if (m_fd >= 0) ::close(m_fd);
+}
+
+int Curl::FileDescriptor::get() const {
+	return m_fd;
+}
+
+Curl::SegmentTransfers::SegmentTransfers(std::vector<Segment>& parts) : m_parts(parts), multi(curl_multi_init()) {
+	if (!multi) throw std::runtime_error("failed curl_multi_init");
+}
+
+Curl::SegmentTransfers::~SegmentTransfers() {
+	for (Segment& part : m_parts) {
+		if (!part.handle) continue;
+		curl_multi_remove_handle(multi, part.handle);
+		curl_easy_cleanup(part.handle);
+		part.handle = nullptr;
+	}
+	curl_multi_cleanup(multi);
+}
+
+Curl::ChunkSink Curl::fd_sink(int fd) {
+	return [fd](std::span<const std::byte> chunk) {
+		while (!chunk.empty()) {
+			const ssize_t written = ::write(fd, chunk.data(), chunk.size());
+			if (written < 0) {
+				if (errno == EINTR) continue;
+				return ChunkAction::ABORT;
+			}
+			chunk = chunk.subspan(written);
+		}
+		return ChunkAction::CONTINUE;
+	};
 }
 
 std::vector<std::string> Curl::get_cookies() const {
@@ -81,6 +406,40 @@ std::vector<std::string> Curl::get_cookies() const {
 	return cookies_v;
 }
 
+void Curl::metrics(CurlMetrics* aggregate) {
+	m_metrics = aggregate;
+}
+
+const TransferMetrics& Curl::last_metrics() const {
+	return m_last_metrics;
+}
+
+Curl::Part Curl::Part::field(const std::string& name, const std::string& value) {
+	Part part;
+	part.name = name;
+	part.value = value;
+	return part;
+}
+
+Curl::Part Curl::Part::file(const std::string& name, const std::filesystem::path& path, const std::string& content_type) {
+	Part part;
+	part.name = name;
+	part.path = path;
+	part.content_type = content_type;
+	return part;
+}
+
+Curl::Part Curl::Part::stream(const std::string& name, const std::string& filename, BodySource source, curl_off_t size,
+		const std::string& content_type) {
+	Part part;
+	part.name = name;
+	part.filename = filename;
+	part.source = std::move(source);
+	part.size = size;
+	part.content_type = content_type;
+	return part;
+}
+
 void Curl::Global::init() {
 	static Global instance;
 }
@@ -105,6 +464,175 @@ size_t Curl::write_to_stream(void* chunk, size_t size, size_t nmemb, void* buf)
 	return realsize;
 }
 
+size_t Curl::write_header(char* line, size_t size, size_t nmemb, void* headers) {
+	const size_t realsize = size * nmemb;
+	auto& header_map = *static_cast<std::map<std::string, std::string>*>(headers);
+	std::string header(line, realsize);
+	if (header.starts_with("HTTP/")) header_map.clear(); // status line of the next response after a redirect
+	if (const auto colon = header.find(':'); colon != std::string::npos) {
+		std::string name = header.substr(0, colon), value = header.substr(colon + 1);
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) {
+			return std::tolower(c);
+		});
+		helper::trim(value);
+		header_map[name] = value;
+	}
+	return realsize;
+}
+
+size_t Curl::read_from_source(char* buffer, size_t size, size_t nitems, void* source) {
+	try {
+		return (*static_cast<const BodySource*>(source))( { reinterpret_cast<std::byte*>(buffer), size * nitems });
+	} catch (...) {
+		return CURL_READFUNC_ABORT;
+	}
+}
+
+std::string Curl::form_encode(const std::map<std::string, std::string>& data) {
+	std::string encoded;
+	for (const auto& [key, val] : data) {
+		char* escaped_key = curl_easy_escape(nullptr, key.data(), key.size());
+		char* escaped_val = curl_easy_escape(nullptr, val.data(), val.size());
+		if (!encoded.empty()) encoded += '&';
+		encoded.append(escaped_key).append("=").append(escaped_val);
+		curl_free(escaped_key);
+		curl_free(escaped_val);
+	}
+	return encoded;
+}
+
+size_t Curl::write_to_sink(void* chunk, size_t size, size_t nmemb, void* state) {
+	const size_t realsize = size * nmemb;
+	auto& stream = *static_cast<StreamState*>(state);
+	while (true) {
+		switch (stream.sink( { static_cast<const std::byte*>(chunk), realsize })) {
+			case ChunkAction::CONTINUE:
+				return realsize;
+			case ChunkAction::PAUSE:
+				if (stream.curl.m_resume.exchange(false)) continue; // resumed before pausing: deliver the chunk again
+				stream.paused = true;
+				return CURL_WRITEFUNC_PAUSE;
+			default:
+				stream.aborted = true;
+				return 0;
+		}
+	}
+}
+
+int Curl::unpause_on_resume(void* state, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+	auto& stream = *static_cast<StreamState*>(state);
+	// a resume() while not paused stays pending for the next PAUSE
+	if (stream.paused && stream.curl.m_resume.exchange(false)) {
+		stream.paused = false; // unpausing may deliver the chunk and pause again right away
+		curl_easy_pause(stream.curl.m_handle, CURLPAUSE_CONT);
+	}
+	return 0;
+}
+
+size_t Curl::write_to_segment(void* chunk, size_t size, size_t nmemb, void* segment) {
+	const size_t realsize = size * nmemb;
+	auto& part = *static_cast<Segment*>(segment);
+	if (!part.started) {
+		part.started = true;
+		long status = 0;
+		curl_easy_getinfo(part.handle, CURLINFO_RESPONSE_CODE, &status);
+		if (status == 200) { // the whole resource: would overwrite the other segments
+			part.whole = true;
+			return 0;
+		}
+		curl_header* range = nullptr;
+		long long first = -1, last = -1, total = part.length;
+		if (status != 206 || curl_easy_header(part.handle, "Content-Range", 0, CURLH_HEADER, -1, &range) != CURLHE_OK
+				|| std::sscanf(range->value, "bytes %lld-%lld/%lld", &first, &last, &total) < 2
+				|| first != part.begin + part.done || last != part.end - 1 || total != part.length)
+			return 0;
+	}
+	// more than the rest of the range would overwrite the next segment
+	if (part.begin + part.done + static_cast<curl_off_t>(realsize) > part.end) return 0;
+
+	const char* data = static_cast<const char*>(chunk);
+	for (size_t written = 0; written < realsize;) {
+		const ssize_t n = ::pwrite(part.fd, data + written, realsize - written, part.begin + part.done);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return 0;
+		}
+		written += n;
+		part.done += n;
+	}
+	return realsize;
+}
+
+bool Curl::load_progress(const std::filesystem::path& sidecar, curl_off_t length, const std::string& validator,
+		std::vector<Segment>& segments) {
+	std::ifstream ifs(sidecar);
+	curl_off_t recorded_length;
+	std::string recorded_validator;
+	if (!(ifs >> recorded_length) || recorded_length != length || ifs.get() != ' ') return false;
+	if (!std::getline(ifs, recorded_validator) || recorded_validator != validator) return false;
+
+	std::vector<Segment> recorded;
+	for (Segment part { -1, 0, 0, 0 }; ifs >> part.begin >> part.end >> part.done;)
+		recorded.push_back(part);
+	if (recorded.empty() || recorded.back().end != length) return false;
+	segments = std::move(recorded);
+	return true;
+}
+
+void Curl::save_progress(const std::filesystem::path& sidecar, curl_off_t length, const std::string& validator,
+		const std::vector<Segment>& segments) {
+	// written aside and renamed, so that a crash leaves either the old or the new record
+	const std::filesystem::path tmp = sidecar.string() + ".tmp";
+	{
+		std::ofstream ofs(tmp, std::ios::trunc);
+		ofs << length << ' ' << validator << '\n';
+		for (const Segment& part : segments)
+			ofs << part.begin << ' ' << part.end << ' ' << part.done << '\n';
+	}
+	std::filesystem::rename(tmp, sidecar);
+}
+
+void Curl::collect_metrics(CURLcode result) const {
+	m_last_metrics = read_metrics(m_handle);
+	if (m_metrics) m_metrics->record(m_last_metrics, result != CURLE_OK);
+	SYLOG(curl_logger, 0) << m_last_metrics.host << " " << m_last_metrics.status << " in " << m_last_metrics.total.count()
+		<< "us (first byte " << m_last_metrics.first_byte.count() << "us)" << std::endl;
+}
+
+void Curl::record_metrics(CURL* handle, CURLcode result) const {
+	if (m_metrics) m_metrics->record(read_metrics(handle), result != CURLE_OK);
+}
+
+TransferMetrics Curl::read_metrics(CURL* handle) {
+	TransferMetrics metrics;
+	const auto elapsed = [handle](CURLINFO info) {
+		curl_off_t us = 0;
+		curl_easy_getinfo(handle, info, &us);
+		return std::chrono::microseconds(us);
+	};
+	metrics.dns = elapsed(CURLINFO_NAMELOOKUP_TIME_T);
+	metrics.connect = elapsed(CURLINFO_CONNECT_TIME_T);
+	// appconnect is 0 when no TLS handshake took place: tls then equals connect, so that tls - connect is 0
+	metrics.tls = std::max(elapsed(CURLINFO_APPCONNECT_TIME_T), metrics.connect);
+	metrics.first_byte = elapsed(CURLINFO_STARTTRANSFER_TIME_T);
+	metrics.total = elapsed(CURLINFO_TOTAL_TIME_T);
+	curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &metrics.status);
+	curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &metrics.bytes_received);
+	curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD_T, &metrics.bytes_sent);
+
+	const char* url = nullptr;
+	curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url);
+	if (CURLU* parsed = curl_url()) {
+		char* host = nullptr;
+		if (url && !curl_url_set(parsed, CURLUPART_URL, url, 0) && !curl_url_get(parsed, CURLUPART_HOST, &host, 0)) {
+			metrics.host = host;
+			curl_free(host);
+		}
+		curl_url_cleanup(parsed);
+	}
+	return metrics;
+}
+
 void Curl::reset_headers() {
 	curl_easy_setopt(m_handle, CURLOPT_HTTPHEADER, NULL);
 	if (m_current_headers) {
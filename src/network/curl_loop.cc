@@ -0,0 +1,227 @@
+#include <stdexcept>
+#include <cerrno>
+#include <cstdint>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include <network/curl_loop.hh>
+#include <network/curl_share.hh>
+
+namespace shimiyuu::network {
+
+CurlLoop::Transfer::Transfer(CurlLoop& loop, std::string url, std::optional<std::string> post_data, std::ostream* os) :
+		loop(loop), url(std::move(url)), post_data(std::move(post_data)), os(os) {
+}
+
+CurlLoop::CurlLoop(const Curl& prototype) :
+		m_prototype(prototype), m_multi(curl_multi_init()),
+		m_epoll(::epoll_create1(EPOLL_CLOEXEC)),
+		m_timer(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+		m_wakeup(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+	if (!m_multi || m_epoll < 0 || m_timer < 0 || m_wakeup < 0) {
+		if (m_multi) curl_multi_cleanup(m_multi);
+		for (const int fd : { m_epoll, m_timer, m_wakeup })
+			if (fd >= 0) ::close(fd);
+		throw std::runtime_error("failed to set up event loop");
+	}
+	try {
+		m_template = prototype.duplicate(m_headers);
+	} catch (...) {
+		curl_multi_cleanup(m_multi);
+		for (const int fd : { m_epoll, m_timer, m_wakeup })
+			::close(fd);
+		throw;
+	}
+
+	for (const int fd : { m_timer, m_wakeup }) {
+		epoll_event event { };
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+	}
+	curl_multi_setopt(m_multi, CURLMOPT_SOCKETFUNCTION, on_socket);
+	curl_multi_setopt(m_multi, CURLMOPT_SOCKETDATA, this);
+	curl_multi_setopt(m_multi, CURLMOPT_TIMERFUNCTION, on_timer);
+	curl_multi_setopt(m_multi, CURLMOPT_TIMERDATA, this);
+	curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX); // HTTP/2 transfers share connections, see Curl::set_http2
+
+	m_thread = std::thread(&CurlLoop::run, this);
+}
+
+CurlLoop::~CurlLoop() {
+	m_stop = true;
+	const std::uint64_t one = 1;
+	(void) !::write(m_wakeup, &one, sizeof(one));
+	m_thread.join();
+
+	for (CURL* handle : m_idle_handles)
+		curl_easy_cleanup(handle);
+	curl_easy_cleanup(m_template);
+	curl_slist_free_all(m_headers);
+	curl_multi_cleanup(m_multi);
+	::close(m_epoll);
+	::close(m_timer);
+	::close(m_wakeup);
+}
+
+CurlLoop::Awaitable<std::string> CurlLoop::get_string(const std::string& url) {
+	return Transfer(*this, url, std::nullopt, nullptr);
+}
+
+CurlLoop::Awaitable<std::string> CurlLoop::post(const std::string& url, const std::map<std::string, std::string>& data) {
+	return Transfer(*this, url, Curl::form_encode(data), nullptr);
+}
+
+CurlLoop::Awaitable<void> CurlLoop::write(const std::string& url, std::ostream& os) {
+	return Transfer(*this, url, std::nullopt, &os);
+}
+
+void CurlLoop::check(const Transfer& transfer) {
+	if (transfer.result)
+		throw std::runtime_error("failed transfer of " + transfer.url + ": " + curl_easy_strerror(transfer.result));
+}
+
+int CurlLoop::on_socket(CURL*, curl_socket_t socket, int what, void* loop, void* registered) {
+	CurlLoop& self = *static_cast<CurlLoop*>(loop);
+	if (what == CURL_POLL_REMOVE) {
+		::epoll_ctl(self.m_epoll, EPOLL_CTL_DEL, socket, nullptr);
+		curl_multi_assign(self.m_multi, socket, nullptr);
+		return 0;
+	}
+
+	epoll_event event { };
+	event.events = (what & CURL_POLL_IN ? EPOLLIN : 0u) | (what & CURL_POLL_OUT ? EPOLLOUT : 0u);
+	event.data.fd = socket;
+	if (registered)
+		::epoll_ctl(self.m_epoll, EPOLL_CTL_MOD, socket, &event);
+	else {
+		::epoll_ctl(self.m_epoll, EPOLL_CTL_ADD, socket, &event);
+		curl_multi_assign(self.m_multi, socket, &self); // any non-null marker
+	}
+	return 0;
+}
+
+int CurlLoop::on_timer(CURLM*, long timeout_ms, void* loop) {
+	itimerspec spec { };
+	if (timeout_ms == 0)
+		spec.it_value.tv_nsec = 1; // 0 would disarm
+	else if (timeout_ms > 0) {
+		spec.it_value.tv_sec = timeout_ms / 1000;
+		spec.it_value.tv_nsec = timeout_ms % 1000 * 1000000;
+	}
+	::timerfd_settime(static_cast<CurlLoop*>(loop)->m_timer, 0, &spec, nullptr);
+	return 0;
+}
+
+bool CurlLoop::enqueue(Transfer* transfer) {
+	{
+		std::scoped_lock lock { m_queue_mtx };
+		if (m_stopped) {
+			transfer->result = CURLE_ABORTED_BY_CALLBACK;
+			return false;
+		}
+		m_queue.push_back(transfer);
+	}
+	const std::uint64_t one = 1;
+	(void) !::write(m_wakeup, &one, sizeof(one));
+	return true;
+}
+
+void CurlLoop::run() {
+	std::vector<epoll_event> events(64);
+	int running;
+	while (!m_stop) {
+		const int ready = ::epoll_wait(m_epoll, events.data(), events.size(), -1);
+		if (ready < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		for (int i = 0; i < ready; ++i) {
+			const int fd = events[i].data.fd;
+			std::uint64_t count;
+			if (fd == m_wakeup) {
+				(void) !::read(m_wakeup, &count, sizeof(count));
+				start_queued();
+			} else if (fd == m_timer) {
+				(void) !::read(m_timer, &count, sizeof(count));
+				curl_multi_socket_action(m_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+			} else {
+				const int flags = (events[i].events & EPOLLIN ? CURL_CSELECT_IN : 0)
+					| (events[i].events & EPOLLOUT ? CURL_CSELECT_OUT : 0)
+					| (events[i].events & (EPOLLERR | EPOLLHUP) ? CURL_CSELECT_ERR : 0);
+				curl_multi_socket_action(m_multi, fd, flags, &running);
+			}
+		}
+
+		int queued;
+		while (CURLMsg* msg = curl_multi_info_read(m_multi, &queued))
+			if (msg->msg == CURLMSG_DONE) finish(msg->easy_handle, msg->data.result);
+	}
+
+	// nothing may stay suspended forever: fail what is left, and what resumed coroutines try to start
+	std::deque<Transfer*> queue;
+	{
+		std::scoped_lock lock { m_queue_mtx };
+		m_stopped = true;
+		queue.swap(m_queue);
+	}
+	for (Transfer* transfer : queue) {
+		transfer->result = CURLE_ABORTED_BY_CALLBACK;
+		transfer->awaiting.resume();
+	}
+	while (!m_active.empty())
+		finish(m_active.begin()->first, CURLE_ABORTED_BY_CALLBACK);
+}
+
+void CurlLoop::start_queued() {
+	std::deque<Transfer*> queue;
+	{
+		std::scoped_lock lock { m_queue_mtx };
+		queue.swap(m_queue);
+	}
+
+	for (Transfer* transfer : queue) {
+		CURL* handle;
+		if (!m_idle_handles.empty()) {
+			handle = m_idle_handles.back();
+			m_idle_handles.pop_back();
+		} else if ((handle = curl_easy_duphandle(m_template))) {
+			if (m_prototype.m_share) curl_easy_setopt(handle, CURLOPT_SHARE, m_prototype.m_share->m_share);
+		} else {
+			transfer->result = CURLE_OUT_OF_MEMORY;
+			transfer->awaiting.resume();
+			continue;
+		}
+
+		if (transfer->post_data)
+			curl_easy_setopt(handle, CURLOPT_POSTFIELDS, transfer->post_data->c_str());
+		else
+			curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+		if (transfer->os) {
+			curl_easy_setopt(handle, CURLOPT_WRITEDATA, transfer->os);
+			curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, Curl::write_to_stream);
+		} else {
+			curl_easy_setopt(handle, CURLOPT_WRITEDATA, &transfer->body);
+			curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, Curl::write_string);
+		}
+		curl_easy_setopt(handle, CURLOPT_URL, transfer->url.c_str());
+
+		m_active.emplace(handle, transfer);
+		curl_multi_add_handle(m_multi, handle);
+	}
+}
+
+void CurlLoop::finish(CURL* handle, CURLcode result) {
+	curl_multi_remove_handle(m_multi, handle);
+	Transfer* transfer = m_active.extract(handle).mapped();
+	m_idle_handles.push_back(handle);
+	m_prototype.record_metrics(handle, result);
+	transfer->result = result;
+	transfer->awaiting.resume(); // may destroy *transfer and queue more transfers
+}
+
+}
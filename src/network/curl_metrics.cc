@@ -0,0 +1,64 @@
+#include <iostream>
+#include <bit>
+#include <algorithm>
+
+#include <network/curl_metrics.hh>
+
+namespace shimiyuu::network {
+
+SYLogger<int> curl_logger(2, std::cerr);
+
+void CurlMetrics::Histogram::add(std::chrono::microseconds value) {
+	++count;
+	total += value;
+	max = std::max(max, value);
+	++buckets[std::min<std::size_t>(std::bit_width(static_cast<std::uint64_t>(std::max<std::int64_t>(value.count(), 0))),
+		buckets.size() - 1)];
+}
+
+std::chrono::microseconds CurlMetrics::Histogram::mean() const {
+	return count ? total / static_cast<std::int64_t>(count) : std::chrono::microseconds { 0 };
+}
+
+void CurlMetrics::record(const TransferMetrics& metrics, bool failed) {
+	std::scoped_lock lock { m_mtx };
+	HostStatistics& host = m_hosts[metrics.host];
+	++host.transfers;
+	if (failed || metrics.status >= 400) ++host.failures;
+	host.bytes_received += metrics.bytes_received;
+	host.bytes_sent += metrics.bytes_sent;
+	++host.status_counts[metrics.status];
+	// libcurl's timings all count from the start of the transfer, and are 0 for phases that did not take place
+	const auto connect = std::max(metrics.connect, metrics.dns), tls = std::max(metrics.tls, connect);
+	host.dns.add(metrics.dns);
+	host.connect.add(connect - metrics.dns);
+	host.tls.add(tls - connect);
+	host.server.add(std::max(metrics.first_byte - tls, std::chrono::microseconds { 0 }));
+	host.total.add(metrics.total);
+}
+
+std::map<std::string, CurlMetrics::HostStatistics> CurlMetrics::snapshot() const {
+	std::scoped_lock lock { m_mtx };
+	return m_hosts;
+}
+
+std::map<std::string, CurlMetrics::HostStatistics> CurlMetrics::reset() {
+	std::scoped_lock lock { m_mtx };
+	return std::exchange(m_hosts, { });
+}
+
+void CurlMetrics::log(int level) const {
+	if (!curl_logger.writes(level)) return;
+	const auto ms = [](std::chrono::microseconds us) {
+		return std::chrono::duration<double, std::milli>(us).count();
+	};
+	for (const auto& [name, host] : snapshot())
+		SYLOG(curl_logger, level) << name << ": " << host.transfers << " transfers, " << host.failures << " failed, "
+			<< host.bytes_received << " bytes received, mean/max ms: dns " << ms(host.dns.mean()) << "/" << ms(host.dns.max)
+			<< " connect " << ms(host.connect.mean()) << "/" << ms(host.connect.max)
+			<< " tls " << ms(host.tls.mean()) << "/" << ms(host.tls.max)
+			<< " server " << ms(host.server.mean()) << "/" << ms(host.server.max)
+			<< " total " << ms(host.total.mean()) << "/" << ms(host.total.max) << std::endl;
+}
+
+}
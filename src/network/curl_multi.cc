@@ -0,0 +1,175 @@
+#include <stdexcept>
+#include <algorithm>
+
+#include <network/curl_multi.hh>
+#include <network/curl_share.hh>
+
+namespace shimiyuu::network {
+
+bool CurlMulti::Response::ok() const {
+	return result == CURLE_OK;
+}
+
+CurlMulti::Transfer::Transfer(std::string url, std::optional<std::string> post_data, Callback on_done) :
+		url(std::move(url)), post_data(std::move(post_data)), on_done(std::move(on_done)) {
+}
+
+CurlMulti::CurlMulti(const Curl& prototype, std::size_t max_transfers, std::size_t max_host_connections) :
+		m_prototype(prototype), m_max_transfers(max_transfers), m_multi(curl_multi_init()) {
+	if (!m_multi) throw std::runtime_error("failed curl_multi_init");
+	try {
+		m_template = prototype.duplicate(m_headers);
+	} catch (...) {
+		curl_multi_cleanup(m_multi);
+		throw;
+	}
+	curl_multi_setopt(m_multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(max_host_connections));
+	curl_multi_setopt(m_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(max_transfers));
+	curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX); // HTTP/2 transfers share connections, see Curl::set_http2
+}
+
+CurlMulti::~CurlMulti() {
+	for (auto& [handle, transfer] : m_active) {
+		curl_multi_remove_handle(m_multi, handle);
+		curl_easy_cleanup(handle);
+	}
+	for (CURL* handle : m_idle_handles)
+		curl_easy_cleanup(handle);
+	curl_easy_cleanup(m_template);
+	curl_slist_free_all(m_headers);
+	curl_multi_cleanup(m_multi);
+}
+
+void CurlMulti::get_string(const std::string& url, Callback on_done) {
+	enqueue(std::make_unique<Transfer>(url, std::nullopt, std::move(on_done)));
+}
+
+void CurlMulti::post(const std::string& url, const std::map<std::string, std::string>& data, Callback on_done) {
+	enqueue(std::make_unique<Transfer>(url, Curl::form_encode(data), std::move(on_done)));
+}
+
+std::future<std::string> CurlMulti::get_string(const std::string& url) {
+	Callback on_done;
+	auto future = future_body(std::make_shared<std::promise<std::string> >(), on_done);
+	get_string(url, std::move(on_done));
+	return future;
+}
+
+std::future<std::string> CurlMulti::post(const std::string& url, const std::map<std::string, std::string>& data) {
+	Callback on_done;
+	auto future = future_body(std::make_shared<std::promise<std::string> >(), on_done);
+	post(url, data, std::move(on_done));
+	return future;
+}
+
+std::future<std::string> CurlMulti::future_body(std::shared_ptr<std::promise<std::string> > promise, Callback& on_done) {
+	on_done = [promise](Response response) {
+		if (response.ok())
+			promise->set_value(std::move(response.body));
+		else
+			promise->set_exception(std::make_exception_ptr(std::runtime_error(
+				"failed transfer of " + response.url + ": " + curl_easy_strerror(response.result))));
+	};
+	return promise->get_future();
+}
+
+void CurlMulti::enqueue(std::unique_ptr<Transfer> transfer) {
+	{
+		std::scoped_lock lock { m_queue_mtx };
+		m_queue.push_back(std::move(transfer));
+	}
+	curl_multi_wakeup(m_multi);
+}
+
+void CurlMulti::start(std::unique_ptr<Transfer> transfer) {
+	CURL* handle;
+	if (!m_idle_handles.empty()) {
+		handle = m_idle_handles.back();
+		m_idle_handles.pop_back();
+	} else if ((handle = curl_easy_duphandle(m_template))) {
+		if (m_prototype.m_share) curl_easy_setopt(handle, CURLOPT_SHARE, m_prototype.m_share->m_share); // not duplicated
+	} else
+		throw std::runtime_error("failed curl_easy_duphandle");
+
+	if (transfer->post_data)
+		curl_easy_setopt(handle, CURLOPT_POSTFIELDS, transfer->post_data->c_str());
+	else
+		curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+	curl_easy_setopt(handle, CURLOPT_WRITEDATA, &transfer->body);
+	curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, Curl::write_string);
+	curl_easy_setopt(handle, CURLOPT_URL, transfer->url.c_str());
+	curl_easy_setopt(handle, CURLOPT_PRIVATE, transfer.get());
+
+	transfer->handle = handle;
+	m_active.emplace(handle, std::move(transfer));
+	curl_multi_add_handle(m_multi, handle);
+}
+
+void CurlMulti::finish(CURL* handle, CURLcode result) {
+	curl_multi_remove_handle(m_multi, handle);
+	auto node = m_active.extract(handle);
+	m_idle_handles.push_back(handle);
+	m_prototype.record_metrics(handle, result);
+
+	Transfer& transfer = *node.mapped();
+	long status = 0;
+	curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+	if (transfer.on_done)
+		transfer.on_done( { std::move(transfer.url), result, status, std::move(transfer.body) });
+}
+
+void CurlMulti::scheduler(CurlScheduler* scheduler) {
+	m_scheduler = scheduler;
+}
+
+std::chrono::milliseconds CurlMulti::start_queued() {
+	constexpr std::chrono::milliseconds max_wait(1000);
+	std::scoped_lock lock { m_queue_mtx };
+	if (!m_scheduler) {
+		while (!m_queue.empty() && m_active.size() < m_max_transfers) {
+			start(std::move(m_queue.front()));
+			m_queue.pop_front();
+		}
+		return max_wait;
+	}
+
+	auto retry_at = CurlScheduler::clock::time_point::max();
+	for (auto it = m_queue.begin(); it != m_queue.end() && m_active.size() < m_max_transfers;) {
+		if (auto permit = m_scheduler->try_acquire((*it)->url, retry_at)) {
+			(*it)->permit.emplace(std::move(*permit));
+			start(std::move(*it));
+			it = m_queue.erase(it);
+		} else
+			++it;
+	}
+	if (retry_at == CurlScheduler::clock::time_point::max()) return max_wait;
+	return std::clamp(std::chrono::ceil<std::chrono::milliseconds>(retry_at - CurlScheduler::clock::now()),
+		std::chrono::milliseconds(0), max_wait);
+}
+
+void CurlMulti::perform() {
+	while (true) {
+		const std::chrono::milliseconds wait = start_queued();
+		if (m_active.empty()) {
+			{
+				std::scoped_lock lock { m_queue_mtx };
+				if (m_queue.empty()) return;
+			}
+			// everything queued is throttled by the scheduler
+			curl_multi_poll(m_multi, nullptr, 0, wait.count(), nullptr);
+			continue;
+		}
+
+		int running;
+		if (const CURLMcode rc = curl_multi_perform(m_multi, &running))
+			throw std::runtime_error(std::string("failed curl_multi_perform: ") + curl_multi_strerror(rc));
+
+		int queued;
+		while (CURLMsg* msg = curl_multi_info_read(m_multi, &queued))
+			if (msg->msg == CURLMSG_DONE) finish(msg->easy_handle, msg->data.result);
+
+		if (running) curl_multi_poll(m_multi, nullptr, 0, wait.count(), nullptr);
+	}
+}
+
+}
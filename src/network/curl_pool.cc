@@ -0,0 +1,49 @@
+#include <network/curl_pool.hh>
+
+namespace shimiyuu::network {
+
+CurlPool::CurlPool(CurlShare* share, std::size_t max_handles) :
+		m_share(share), m_max_handles(max_handles) {
+}
+
+CurlPool::Lease CurlPool::acquire() {
+	std::unique_lock lock { m_mtx };
+	m_returned.wait(lock, [this] {
+		return !m_idle.empty() || !m_max_handles || m_handles < m_max_handles;
+	});
+	if (!m_idle.empty()) {
+		std::unique_ptr<Curl> curl = std::move(m_idle.back());
+		m_idle.pop_back();
+		return Lease(*this, std::move(curl));
+	}
+	++m_handles;
+	lock.unlock();
+	return Lease(*this, m_share ? std::make_unique<Curl>(*m_share) : std::make_unique<Curl>());
+}
+
+void CurlPool::release(std::unique_ptr<Curl> curl) {
+	curl->reset();
+	{
+		std::scoped_lock lock { m_mtx };
+		m_idle.push_back(std::move(curl));
+	}
+	m_returned.notify_one();
+}
+
+CurlPool::Lease::Lease(CurlPool& pool, std::unique_ptr<Curl> curl) :
+		m_pool(&pool), m_curl(std::move(curl)) {
+}
+
+CurlPool::Lease::~Lease() {
+	if (m_curl) m_pool->release(std::move(m_curl));
+}
+
+Curl& CurlPool::Lease::operator*() const {
+	return *m_curl;
+}
+
+Curl* CurlPool::Lease::operator->() const {
+	return m_curl.get();
+}
+
+}
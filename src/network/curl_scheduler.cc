@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+#include <network/curl_scheduler.hh>
+
+namespace shimiyuu::network {
+
+CurlScheduler::Permit::Permit(CurlScheduler& scheduler) :
+		m_scheduler(&scheduler) {
+}
+
+CurlScheduler::Permit::~Permit() {
+	if (m_scheduler) m_scheduler->release();
+}
+
+CurlScheduler::Permit::Permit(Permit&& other) :
+		m_scheduler(std::exchange(other.m_scheduler, nullptr)) {
+}
+
+void CurlScheduler::Bucket::refill(clock::time_point now) {
+	if (std::isinf(limit.requests_per_second))
+		tokens = limit.burst;
+	else
+		tokens = std::min(limit.burst, tokens + std::chrono::duration<double>(now - refilled).count() * limit.requests_per_second);
+	refilled = now;
+}
+
+CurlScheduler::clock::time_point CurlScheduler::Bucket::next_token() const {
+	if (tokens >= 1) return refilled;
+	return refilled + std::chrono::duration_cast<clock::duration>(
+		std::chrono::duration<double>((1 - tokens) / limit.requests_per_second));
+}
+
+bool CurlScheduler::Waiter::operator<(const Waiter& other) const {
+	return priority != other.priority ? priority > other.priority : sequence < other.sequence;
+}
+
+CurlScheduler::CurlScheduler(std::size_t max_in_flight) :
+		CurlScheduler(max_in_flight, Limit { }) {
+}
+
+CurlScheduler::CurlScheduler(std::size_t max_in_flight, Limit default_limit) :
+		m_max_in_flight(max_in_flight), m_default_limit(default_limit) {
+	if (!max_in_flight) throw std::invalid_argument("max_in_flight must be positive");
+}
+
+void CurlScheduler::limit(const std::string& host, Limit limit) {
+	if (!(limit.requests_per_second > 0) || limit.burst < 1) throw std::invalid_argument("invalid limit for " + host);
+	std::scoped_lock lock { m_mtx };
+	const clock::time_point now = clock::now();
+	Bucket& host_bucket = m_buckets.try_emplace(host, Bucket { limit, limit.burst, now }).first->second;
+	host_bucket.refill(now);
+	host_bucket.limit = limit;
+	host_bucket.tokens = std::min(host_bucket.tokens, limit.burst);
+	m_changed.notify_all();
+}
+
+CurlScheduler::Permit CurlScheduler::acquire(const std::string& url, int priority) {
+	std::unique_lock lock { m_mtx };
+	const auto waiter = m_waiters.insert( { priority, m_sequence++, &bucket(url) }).first;
+	while (true) {
+		const clock::time_point next_token = grant();
+		if (waiter->granted) break;
+		if (next_token == clock::time_point::max())
+			m_changed.wait(lock);
+		else
+			m_changed.wait_until(lock, next_token);
+	}
+	m_waiters.erase(waiter);
+	return Permit(*this);
+}
+
+std::optional<CurlScheduler::Permit> CurlScheduler::try_acquire(const std::string& url, clock::time_point& retry_at,
+		int priority) {
+	std::scoped_lock lock { m_mtx };
+	Bucket& host_bucket = bucket(url);
+	const auto waiter = m_waiters.insert( { priority, m_sequence++, &host_bucket }).first;
+	grant();
+	const bool granted = waiter->granted;
+	m_waiters.erase(waiter);
+	if (granted) return Permit(*this);
+	if (host_bucket.tokens < 1) retry_at = std::min(retry_at, host_bucket.next_token());
+	return std::nullopt;
+}
+
+std::string CurlScheduler::get_string(const Curl& curl, const std::string& url, int priority) {
+	const Permit permit = acquire(url, priority);
+	return curl.get_string(url);
+}
+
+std::string CurlScheduler::host_of(const std::string& url) {
+	std::string host;
+	if (CURLU* parsed = curl_url()) {
+		char* part = nullptr;
+		if (!curl_url_set(parsed, CURLUPART_URL, url.c_str(), 0) && !curl_url_get(parsed, CURLUPART_HOST, &part, 0)) {
+			host = part;
+			curl_free(part);
+		}
+		curl_url_cleanup(parsed);
+	}
+	return host;
+}
+
+CurlScheduler::Bucket& CurlScheduler::bucket(const std::string& url) {
+	const std::string host = host_of(url);
+	auto it = m_buckets.find(host);
+	if (it == m_buckets.end())
+		it = m_buckets.emplace(host, Bucket { m_default_limit, m_default_limit.burst, clock::now() }).first;
+	return it->second;
+}
+
+CurlScheduler::clock::time_point CurlScheduler::grant() {
+	const clock::time_point now = clock::now();
+	clock::time_point next_token = clock::time_point::max();
+	bool granted = false;
+	for (const Waiter& waiter : m_waiters) {
+		if (m_in_flight == m_max_in_flight) break;
+		if (waiter.granted) continue;
+		waiter.bucket->refill(now);
+		if (waiter.bucket->tokens >= 1) {
+			waiter.bucket->tokens -= 1;
+			waiter.granted = granted = true;
+			++m_in_flight;
+		} else
+			next_token = std::min(next_token, waiter.bucket->next_token());
+	}
+	if (granted) m_changed.notify_all();
+	return next_token;
+}
+
+void CurlScheduler::release() {
+	std::scoped_lock lock { m_mtx };
+	--m_in_flight;
+	grant();
+	m_changed.notify_all();
+}
+
+}
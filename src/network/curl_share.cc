@@ -0,0 +1,32 @@
+#include <stdexcept>
+
+#include <network/curl_share.hh>
+#include <network/curl.hh>
+
+namespace shimiyuu::network {
+
+CurlShare::CurlShare(bool share_cookies) {
+	Curl::Global::init();
+	m_share = curl_share_init();
+	if (!m_share) throw std::runtime_error("failed curl_share_init");
+	curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, lock);
+	curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, unlock);
+	curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+	curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	if (share_cookies) curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+}
+
+CurlShare::~CurlShare() {
+	curl_share_cleanup(m_share);
+}
+
+void CurlShare::lock(CURL*, curl_lock_data data, curl_lock_access, void* share) {
+	static_cast<CurlShare*>(share)->m_locks[data].lock();
+}
+
+void CurlShare::unlock(CURL*, curl_lock_data data, void* share) {
+	static_cast<CurlShare*>(share)->m_locks[data].unlock();
+}
+
+}
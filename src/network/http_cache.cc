@@ -0,0 +1,137 @@
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <iomanip>
+#include <functional>
+
+#include <network/http_cache.hh>
+
+namespace shimiyuu::network {
+
+static std::string now_ms() {
+	return std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+HttpCache::HttpCache(const std::filesystem::path& directory, std::uint64_t max_bytes) :
+		m_directory(directory), m_max_bytes(max_bytes),
+		m_index((std::filesystem::create_directories(directory), directory / "index.sqlite3").string()) {
+	m_index.query("CREATE TABLE IF NOT EXISTS entries("
+		"key TEXT PRIMARY KEY NOT NULL, file TEXT NOT NULL, etag TEXT NOT NULL, last_modified TEXT NOT NULL,"
+		" size INTEGER NOT NULL, last_access INTEGER NOT NULL);").next();
+	m_index.query("CREATE INDEX IF NOT EXISTS entries_lru ON entries(last_access, size, file);").next();
+
+	for (const auto row : m_index.query("SELECT coalesce(sum(size), 0) FROM entries;"))
+		m_statistics.stored_bytes = row.integer(0);
+}
+
+std::string HttpCache::get_string(const Curl& curl, const std::string& url, const std::vector<std::string>& request_headers) {
+	std::string key = url;
+	for (const curl_slist* header = curl.m_current_headers; header; header = header->next)
+		key += std::string("\n") + header->data;
+	for (const std::string& header : request_headers)
+		key += "\n" + header;
+
+	std::vector<std::string> headers(request_headers);
+	std::optional<Entry> entry;
+	{
+		std::scoped_lock lock { m_mtx };
+		entry = lookup(key);
+	}
+	if (entry) {
+		if (!entry->etag.empty()) headers.push_back("If-None-Match: " + entry->etag);
+		if (!entry->last_modified.empty()) headers.push_back("If-Modified-Since: " + entry->last_modified);
+	}
+
+	Curl::Response response = curl.get(url, headers);
+
+	std::scoped_lock lock { m_mtx };
+	if (entry && response.status == 304) {
+		std::ifstream ifs(m_directory / entry->file, std::ios::binary);
+		if (!ifs) { // body file removed behind our back: fetch unconditionally
+			response = curl.get(url, request_headers);
+		} else {
+			++m_statistics.hits;
+			touch(key);
+			std::ostringstream body;
+			body << ifs.rdbuf();
+			return body.str();
+		}
+	}
+	++m_statistics.misses;
+	if (response.status == 200) store(key, response);
+	return std::move(response.body);
+}
+
+HttpCache::Statistics HttpCache::statistics() const {
+	std::scoped_lock lock { m_mtx };
+	return m_statistics;
+}
+
+std::optional<HttpCache::Entry> HttpCache::lookup(const std::string& key) {
+	for (const auto row : m_index.query("SELECT file, etag, last_modified FROM entries WHERE key = ?;", { key }))
+		return Entry { std::string(row.text(0)), std::string(row.text(1)), std::string(row.text(2)) };
+	return std::nullopt;
+}
+
+void HttpCache::touch(const std::string& key) {
+	m_index.update("entries", { { "last_access", now_ms() } }, { { "key", key } });
+}
+
+void HttpCache::store(const std::string& key, const Curl::Response& response) {
+	const auto header = [&](const std::string& name) {
+		const auto it = response.headers.find(name);
+		return it == response.headers.end() ? std::string() : it->second;
+	};
+	const std::string etag = header("etag"), last_modified = header("last-modified");
+	const bool cacheable = (!etag.empty() || !last_modified.empty())
+		&& header("cache-control").find("no-store") == std::string::npos
+		&& response.body.size() <= m_max_bytes;
+
+	std::optional<std::uint64_t> old_size;
+	for (const auto row : m_index.query("SELECT size FROM entries WHERE key = ?;", { key }))
+		old_size = row.integer(0);
+	if (old_size) m_statistics.stored_bytes -= *old_size;
+
+	std::ostringstream file;
+	file << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string> { }(key);
+	if (!cacheable) {
+		if (old_size) {
+			m_index.remove("entries", { { "key", key } });
+			std::filesystem::remove(m_directory / file.str());
+		}
+		return;
+	}
+
+	std::ofstream(m_directory / file.str(), std::ios::binary).write(response.body.data(), response.body.size());
+	// another key with the same hash loses its body
+	for (const auto row : m_index.query("SELECT size FROM entries WHERE file = ? AND key <> ?;", { file.str(), key }))
+		m_statistics.stored_bytes -= row.integer(0);
+	m_index.remove("entries", { { "file", file.str() } });
+	m_index.upsert("entries", { "key" }, {
+		{ "key", key }, { "file", file.str() }, { "etag", etag }, { "last_modified", last_modified },
+		{ "size", std::to_string(response.body.size()) }, { "last_access", now_ms() }
+	});
+	m_statistics.stored_bytes += response.body.size();
+	evict();
+}
+
+void HttpCache::evict() {
+	if (m_statistics.stored_bytes <= m_max_bytes) return;
+
+	std::vector<std::pair<std::string, std::uint64_t> > evicted; // file, size
+	std::uint64_t remaining = m_statistics.stored_bytes;
+	for (const auto row : m_index.query("SELECT file, size FROM entries ORDER BY last_access;")) {
+		if (remaining <= m_max_bytes) break;
+		evicted.emplace_back(row.text(0), row.integer(1));
+		remaining -= row.integer(1);
+	}
+	for (const auto& [file, size] : evicted) {
+		m_index.remove("entries", { { "file", file } });
+		std::filesystem::remove(m_directory / file);
+		m_statistics.stored_bytes -= size;
+		++m_statistics.evictions;
+	}
+}
+
+}
@@ -0,0 +1,78 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <functional>
+#include <filesystem>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include <DelimitedImporter.hh>
+
+using namespace shimiyuu;
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+	if (!condition) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+static bool throws(const std::function<void()>& f) {
+	try {
+		f();
+	} catch (const std::exception&) {
+		return true;
+	}
+	return false;
+}
+
+static std::string rows(SQLite3DB& db, const std::string& sql) {
+	std::string values;
+	for (const auto row : db.query(sql)) {
+		for (int column = 0; column < row.size(); ++column)
+			values += std::string(column ? "," : "") + std::string(row.text(column));
+		values += ';';
+	}
+	return values;
+}
+
+int main() {
+	const std::filesystem::path file = std::filesystem::temp_directory_path()
+		/ ("delimited_importer_test." + std::to_string(getpid()) + ".csv");
+	const auto write = [&](const std::string& contents) {
+		std::ofstream(file, std::ios::binary) << contents;
+		return file.string();
+	};
+
+	SQLite3DB db(":memory:");
+	db.query("CREATE TABLE t(\"order\" INTEGER UNIQUE, \"first name\" TEXT);").next();
+	DelimitedImporter::Options options;
+	options.batch_rows = 2;
+
+	// header names that are keywords or contain spaces are quoted
+	DelimitedImporter(write("order,first name\r\n1,a\r\n2,b\r\n3,c\r\n")).import(db, "t", options);
+	check(rows(db, "SELECT * FROM t ORDER BY \"order\";") == "1,a;2,b;3,c;", "rows imported under quoted header names");
+
+	// a bad record in a later batch leaves the table as it was
+	check(throws([&] {
+		DelimitedImporter(write("order,first name\n4,d\n5,e\n6,f\n7\n8,h\n")).import(db, "t", options);
+	}), "record with missing field throws");
+	check(rows(db, "SELECT count(*) FROM t;") == "3;", "failed import leaves no rows of the file");
+	check(throws([&] {
+		DelimitedImporter(write("order,first name\n4,d\n5,e\n6,f\n1,x\n")).import(db, "t", options);
+	}), "duplicate key throws");
+	check(rows(db, "SELECT count(*) FROM t;") == "3;", "import failing on a constraint leaves no rows of the file");
+
+	// blank lines are empty values in single-column files, and skipped otherwise
+	db.query("CREATE TABLE v(value TEXT);").next();
+	DelimitedImporter(write("value\na\n\nb\n")).import(db, "v", options);
+	check(rows(db, "SELECT value FROM v ORDER BY rowid;") == "a;;b;", "blank line of a single-column file is an empty value");
+	DelimitedImporter(write("order,first name\n\n9,i\n\r\n10,j\n")).import(db, "t", options);
+	check(rows(db, "SELECT count(*) FROM t;") == "5;", "blank lines are skipped");
+
+	std::filesystem::remove(file);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <network/http_cache.hh>
+
+using namespace shimiyuu::network;
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+	if (!condition) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+/** stand-in for an origin server: one request per connection, answering from the request line and If-None-Match */
+class Server {
+
+public:
+	std::atomic<bool> no_store = false; // /toggle answers with Cache-Control: no-store
+	std::atomic<int> conditional_requests = 0;
+
+	Server() {
+		m_fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr { };
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(addr);
+		if (bind(m_fd, reinterpret_cast<sockaddr*>(&addr), length) || listen(m_fd, 16)
+				|| getsockname(m_fd, reinterpret_cast<sockaddr*>(&addr), &length))
+			throw std::runtime_error("cannot listen on the loopback interface");
+		m_port = ntohs(addr.sin_port);
+		m_thread = std::thread(&Server::run, this);
+	}
+
+	~Server() {
+		shutdown(m_fd, SHUT_RDWR);
+		close(m_fd);
+		m_thread.join();
+	}
+
+	std::string url(const std::string& path) const {
+		return "http://127.0.0.1:" + std::to_string(m_port) + path;
+	}
+
+private:
+	void run() {
+		for (int client; (client = accept(m_fd, nullptr, nullptr)) >= 0; close(client)) {
+			std::string request;
+			char buffer[4096];
+			for (ssize_t n; request.find("\r\n\r\n") == std::string::npos && (n = read(client, buffer, sizeof(buffer))) > 0; )
+				request.append(buffer, n);
+			const std::string response = respond(request);
+			for (std::size_t sent = 0; sent < response.size(); ) {
+				const ssize_t n = write(client, response.data() + sent, response.size() - sent);
+				if (n <= 0) break;
+				sent += n;
+			}
+		}
+	}
+
+	std::string respond(const std::string& request) {
+		const std::string path = request.substr(4, request.find(' ', 4) - 4);
+		const bool conditional = request.find("If-None-Match: \"v1\"") != std::string::npos;
+		if (conditional) ++conditional_requests;
+
+		std::string headers = "ETag: \"v1\"\r\n", body = "body of " + path;
+		if (path == "/toggle" && no_store) headers += "Cache-Control: no-store\r\n";
+		else if (conditional) return "HTTP/1.1 304 Not Modified\r\n" + headers + "Connection: close\r\n\r\n";
+		return "HTTP/1.1 200 OK\r\n" + headers + "Content-Length: " + std::to_string(body.size())
+			+ "\r\nConnection: close\r\n\r\n" + body;
+	}
+
+	int m_fd;
+	unsigned short m_port;
+	std::thread m_thread;
+};
+
+int main() {
+	const std::filesystem::path directory = std::filesystem::temp_directory_path()
+		/ ("http_cache_test." + std::to_string(getpid()));
+	Server server;
+	Curl curl;
+	{
+		HttpCache cache(directory, 1 << 20);
+		check(cache.get_string(curl, server.url("/etag")) == "body of /etag", "first GET returns the body");
+		check(cache.get_string(curl, server.url("/etag")) == "body of /etag", "revalidated GET returns the stored body");
+		check(cache.statistics().hits == 1 && cache.statistics().misses == 1, "second GET is a hit");
+		const std::uint64_t etag_bytes = cache.statistics().stored_bytes;
+		check(etag_bytes == std::string("body of /etag").size(), "stored_bytes counts the stored body");
+
+		cache.get_string(curl, server.url("/toggle"));
+		check(cache.statistics().stored_bytes == etag_bytes + std::string("body of /toggle").size(), "/toggle is stored");
+
+		// no longer cacheable: the entry is dropped and no longer revalidated
+		server.no_store = true;
+		cache.get_string(curl, server.url("/toggle"));
+		check(cache.statistics().stored_bytes == etag_bytes, "non-cacheable response releases the stored body");
+		const int conditional_requests = server.conditional_requests;
+		cache.get_string(curl, server.url("/toggle"));
+		check(server.conditional_requests == conditional_requests, "dropped entry is not revalidated");
+		check(cache.statistics().stored_bytes == etag_bytes, "stored_bytes is unchanged by a repeated non-cacheable response");
+	}
+	{
+		HttpCache cache(directory, 1 << 20);
+		check(cache.statistics().stored_bytes == std::string("body of /etag").size(), "reopened index matches stored_bytes");
+	}
+	std::filesystem::remove_all(directory);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
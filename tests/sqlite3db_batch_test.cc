@@ -0,0 +1,74 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdlib>
+
+#include <SQLite3DB.hh>
+
+using namespace shimiyuu;
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+	if (!condition) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+static bool throws(const std::function<void()>& f) {
+	try {
+		f();
+	} catch (const std::exception&) {
+		return true;
+	}
+	return false;
+}
+
+static std::string column(SQLite3DB& db, const std::string& sql) {
+	std::string values;
+	for (const auto row : db.query(sql))
+		values += std::string(values.empty() ? "" : ",") + std::string(row.text(0));
+	return values;
+}
+
+/** batches that fail partway through leave the table as it was */
+int main() {
+	SQLite3DB db(":memory:");
+	db.query("CREATE TABLE t(id INTEGER UNIQUE NOT NULL);").next();
+
+	for (std::size_t rows_per_statement : { 1, 2 }) {
+		check(throws([&] { db.insert("t", { "id" }, { { "1" }, { "2" }, { "1" }, { "3" } }, rows_per_statement); }),
+			"duplicate key in a batch throws");
+		check(column(db, "SELECT id FROM t;").empty(),
+			"failed batch of " + std::to_string(rows_per_statement) + " rows per statement leaves no rows");
+	}
+	db.insert("t", { "id" }, { { "1" }, { "2" }, { "3" } }, 2);
+	check(column(db, "SELECT id FROM t ORDER BY id;") == "1,2,3", "batch without conflicts is committed");
+
+	check(throws([&] {
+		auto transaction = db.start_transaction();
+		db.insert("t", { { "id", "4" } });
+		db.insert("t", { { "id", "1" } });
+	}), "duplicate key in a transaction throws");
+	check(column(db, "SELECT id FROM t ORDER BY id;") == "1,2,3", "transaction left by an exception is rolled back");
+	{
+		auto transaction = db.start_transaction();
+		db.insert("t", { { "id", "4" } });
+	}
+	check(column(db, "SELECT id FROM t ORDER BY id;") == "1,2,3,4", "transaction left normally is committed");
+
+	db.query("CREATE TABLE kv(k INTEGER PRIMARY KEY, v TEXT UNIQUE NOT NULL);").next();
+	db.insert("kv", { "k", "v" }, { { "1", "a" }, { "2", "b" }, { "3", "c" } });
+	check(throws([&] { db.update("kv", { "v" }, { "k" }, { { "x", "1" }, { "c", "2" }, { "y", "3" } }); }),
+		"keyed update to a duplicate value throws");
+	check(column(db, "SELECT v FROM kv ORDER BY k;") == "a,b,c", "failed keyed update leaves no row changed");
+	check(throws([&] { db.upsert("kv", { "k" }, { "k", "v" }, { { "1", "x" }, { "4", "d" }, { "2", "c" } }); }),
+		"upsert to a duplicate value throws");
+	check(column(db, "SELECT v FROM kv ORDER BY k;") == "a,b,c", "failed upsert batch leaves no row changed");
+	db.upsert("kv", { "k" }, { "k", "v" }, { { "1", "x" }, { "4", "d" } });
+	check(column(db, "SELECT v FROM kv ORDER BY k;") == "x,b,c,d", "upsert batch without conflicts is committed");
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <filesystem>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include <SQLite3DBPool.hh>
+
+using namespace shimiyuu;
+
+static std::int64_t single(SQLite3DB& db, const std::string& sql) {
+	for (const auto row : db.query(sql))
+		return row.integer(0);
+	throw std::runtime_error("no result for " + sql);
+}
+
+/**
+ * One writer moves amounts between accounts and logs each transfer in one transaction, while readers check
+ * within their own transactions that they never see a partial transfer and that no read fails with SQLITE_BUSY.
+ */
+int main() {
+	constexpr std::size_t reader_count = 4;
+	constexpr int accounts = 10, balance = 100, transfers = 2000;
+
+	const std::filesystem::path directory = std::filesystem::temp_directory_path()
+		/ ("sqlite3db_pool_test." + std::to_string(getpid()));
+	std::filesystem::create_directories(directory);
+
+	std::atomic<int> failures = 0;
+	{
+		SQLite3DBPool pool((directory / "pool.sqlite3").string(), reader_count);
+		{
+			auto writer = pool.writer();
+			writer->query("CREATE TABLE accounts(id INTEGER PRIMARY KEY, balance INTEGER NOT NULL);").next();
+			writer->query("CREATE TABLE transfers(id INTEGER PRIMARY KEY, amount INTEGER NOT NULL);").next();
+			writer->query("CREATE TABLE meta(generation INTEGER NOT NULL);").next();
+			writer->query("INSERT INTO meta VALUES(0);").next();
+			for (int id = 0; id < accounts; ++id)
+				writer->insert("accounts", { { "id", std::to_string(id) }, { "balance", std::to_string(balance) } });
+		}
+
+		std::atomic<bool> done = false;
+		std::atomic<std::uint64_t> reads = 0;
+		std::vector<std::thread> readers;
+		for (std::size_t i = 0; i < reader_count; ++i) {
+			readers.emplace_back([&] {
+				std::int64_t last_generation = 0;
+				try {
+					while (!done) {
+						auto reader = pool.reader();
+						auto transaction = reader->start_transaction();
+						const std::int64_t generation = single(*reader, "SELECT generation FROM meta;");
+						const std::int64_t logged = single(*reader, "SELECT count(*) FROM transfers;");
+						const std::int64_t total = single(*reader, "SELECT sum(balance) FROM accounts;");
+						if (generation != logged || total != accounts * balance || generation < last_generation) {
+							std::cerr << "FAILED: inconsistent snapshot: generation " << generation << ", " << logged
+								<< " transfers, total " << total << std::endl;
+							++failures;
+							return;
+						}
+						last_generation = generation;
+						++reads;
+					}
+				} catch (const std::exception& e) {
+					std::cerr << "FAILED: reader: " << e.what() << std::endl;
+					++failures;
+				}
+			});
+		}
+
+		try {
+			for (int i = 0; i < transfers; ++i) {
+				const std::string amount = std::to_string(i % 7 + 1);
+				auto writer = pool.writer();
+				auto transaction = writer->start_transaction();
+				writer->query("UPDATE accounts SET balance = balance - ? WHERE id = ?;",
+					{ amount, std::to_string(i % accounts) }).next();
+				writer->query("INSERT INTO transfers(amount) VALUES(?);", { amount }).next();
+				writer->query("UPDATE meta SET generation = generation + 1;").next();
+				writer->query("UPDATE accounts SET balance = balance + ? WHERE id = ?;",
+					{ amount, std::to_string((i + 3) % accounts) }).next();
+			}
+		} catch (const std::exception& e) {
+			std::cerr << "FAILED: writer: " << e.what() << std::endl;
+			++failures;
+		}
+		done = true;
+		for (auto& reader : readers)
+			reader.join();
+
+		if (single(*pool.reader(), "SELECT generation FROM meta;") != transfers) {
+			std::cerr << "FAILED: readers do not see the last commit" << std::endl;
+			++failures;
+		}
+		if (!reads) {
+			std::cerr << "FAILED: no read completed" << std::endl;
+			++failures;
+		}
+	}
+	std::filesystem::remove_all(directory);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}